@@ -0,0 +1,56 @@
+#include "animation.h"
+
+AnimationFrame animationFrame(const Animation& animation, uint64_t elapsedUs, int textWidth)
+{
+	AnimationFrame frame;
+	uint64_t periodUs = (uint64_t)(animation.periodMs > 0 ? animation.periodMs : 1) * 1000;
+	uint64_t phaseUs = elapsedUs % periodUs;
+	switch (animation.kind) {
+	case AnimationKind::Marquee: {
+		uint64_t loop = (uint64_t)(textWidth > 0 ? textWidth : 0) + (animation.gap > 0 ? animation.gap : 0);
+		if (loop && animation.speed > 0) {
+			frame.offset = (int)(elapsedUs * animation.speed / 1000000 % loop);
+		}
+		break;
+	}
+	case AnimationKind::Fade: {
+		// Down to `minAlpha` halfway through the period and back up
+		uint64_t half = periodUs / 2 ? periodUs / 2 : 1;
+		uint64_t dist = phaseUs < half ? phaseUs : periodUs - phaseUs;
+		frame.alpha = (uint8_t)(255 - (255 - animation.minAlpha) * (dist > half ? half : dist) / half);
+		break;
+	}
+	case AnimationKind::Blink:
+		frame.alpha = phaseUs < periodUs / 2 ? 255 : animation.minAlpha;
+		break;
+	case AnimationKind::None:
+		break;
+	}
+	return frame;
+}
+
+void fadePixels(uint32_t *pixels, int stride, int x0, int x1, int height, uint8_t alpha)
+{
+	if (alpha == 255) {
+		return;
+	}
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = pixels + y * stride;
+		for (int x = x0; x < x1; x++) {
+			// Red and blue, then green and alpha, two channels per multiply
+			uint32_t rb = (row[x] & 0x00ff00ff) * alpha;
+			uint32_t ga = ((row[x] >> 8) & 0x00ff00ff) * alpha;
+			row[x] = ((rb >> 8) & 0x00ff00ff) | (ga & 0xff00ff00);
+		}
+	}
+}
+
+bool FrameClock::tick(uint64_t nowUs)
+{
+	if (nowUs < nextUs) {
+		return false;
+	}
+	frameUs = nowUs;
+	nextUs = nextUs + intervalUs > nowUs ? nextUs + intervalUs : nowUs + intervalUs;
+	return true;
+}
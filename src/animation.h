@@ -0,0 +1,56 @@
+#pragma once
+
+// Native block animations, advanced by the renderer on a shared frame clock
+//
+// An animation is set once and turned into a frame from the time since it was set: a marquee scrolls text
+// that doesn't fit through its span, fade and blink change the opacity of the whole block. Every animated
+// block is advanced on the same clock tick, and only blocks whose frame changed need redrawing.
+
+#include <cstdint>
+
+enum class AnimationKind { None, Marquee, Fade, Blink };
+
+struct Animation {
+	AnimationKind kind = AnimationKind::None;
+	int speed = 30; // Marquee pixels per second
+	int gap = 40; // Marquee pixels between the end of the text and its next pass
+	int periodMs = 1000; // Of a fade in and out, or a blink on and off
+	uint8_t minAlpha = 0; // Faded or blinked down to
+
+	bool operator==(const Animation&) const = default;
+};
+
+struct AnimationFrame {
+	int offset = 0; // Marquee pixels scrolled, the text drawn again `textWidth + gap` after
+	uint8_t alpha = 255;
+
+	bool operator==(const AnimationFrame&) const = default;
+};
+
+// Frame `elapsedUs` after the animation was set, for text `textWidth` pixels wide
+AnimationFrame animationFrame(const Animation& animation, uint64_t elapsedUs, int textWidth);
+
+// Scales premultiplied pixels from column `x0` to `x1` by `alpha`
+void fadePixels(uint32_t *pixels, int stride, int x0, int x1, int height, uint8_t alpha);
+
+// Ticks at a fixed rate, skipping frames missed while the caller was busy
+class FrameClock {
+	uint64_t intervalUs;
+	uint64_t nextUs = 0;
+	uint64_t frameUs = 0;
+
+public:
+	FrameClock(int fps) : intervalUs(1000000 / (fps > 0 ? fps : 1)) {};
+
+	// Returns true once per interval, starting a frame at `nowUs`
+	bool tick(uint64_t nowUs);
+
+	// Start of the current frame, what every block is advanced to
+	uint64_t now() const {
+		return frameUs;
+	}
+
+	uint64_t interval() const {
+		return intervalUs;
+	}
+};
@@ -0,0 +1,50 @@
+#include "barplan.h"
+
+bool BarPlanner::plan(const std::vector<BarGeometry>& bars, const std::vector<BarMask>& masks)
+{
+	if (bars == lastBars && masks == lastMasks) {
+		return false;
+	}
+	lastBars = bars;
+	lastMasks = masks;
+	surfaces.clear();
+	barSurfaces.assign(bars.size(), 0);
+
+	std::vector<size_t> items;
+	for (size_t bar = 0; bar < bars.size(); bar++) {
+		items.clear();
+		for (size_t i = 0; bar < BAR_MAX && i < masks.size(); i++) {
+			if (masks[i] & ((BarMask)1 << bar)) {
+				items.push_back(i);
+			}
+		}
+
+		// Few bars, a linear search is plenty
+		size_t s = 0;
+		while (s < surfaces.size() && !(surfaces[s].geometry == bars[bar] && surfaces[s].items == items)) {
+			s++;
+		}
+		if (s == surfaces.size()) {
+			surfaces.push_back({ .geometry = bars[bar], .items = items, .layout = LayoutEngine(separatorWidth) });
+		}
+		surfaces[s].bars.push_back(bar);
+		barSurfaces[bar] = s;
+	}
+	return true;
+}
+
+void BarPlanner::layout(const std::vector<LayoutItem>& items, std::vector<bool>& changed)
+{
+	changed.assign(surfaces.size(), false);
+	for (size_t s = 0; s < surfaces.size(); s++) {
+		BarSurface& surface = surfaces[s];
+		scratch.clear();
+		for (size_t i : surface.items) {
+			scratch.push_back(items[i]);
+		}
+		if (surface.layout.update(scratch, surface.geometry.width)) {
+			surface.hits.build(surface.layout.get());
+			changed[s] = true;
+		}
+	}
+}
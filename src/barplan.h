@@ -0,0 +1,65 @@
+#pragma once
+
+// Decides which taskbars can share a layout and a raster
+//
+// A bar shows the blocks whose mask has its bit. Bars of the same size and DPI showing the same blocks,
+// as when mirroring to every monitor, make one surface: laid out and drawn once, then presented to each
+// of them. Doesn't touch any window, so simulated geometries can be planned headlessly.
+
+#include "layout.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using BarMask = uint32_t; // Bit per bar index, 0 being the primary taskbar
+inline constexpr BarMask barMaskAll = ~(BarMask)0;
+#define BAR_MAX 32 // Bars past this show nothing
+
+struct BarGeometry {
+	int width, height; // Of the area blocks are drawn in
+	int dpi;
+
+	bool operator==(const BarGeometry&) const = default;
+};
+
+struct BarSurface {
+	BarGeometry geometry;
+	std::vector<size_t> items; // Indexes of the items shown, in the order given to `layout`
+	std::vector<size_t> bars; // Presented to, ascending
+	LayoutEngine layout;
+	HitIndex hits; // Hit items index `items`
+};
+
+class BarPlanner {
+	int separatorWidth;
+	std::vector<BarGeometry> lastBars;
+	std::vector<BarMask> lastMasks;
+	std::vector<BarSurface> surfaces; // In order of their first bar
+	std::vector<size_t> barSurfaces;
+	std::vector<LayoutItem> scratch;
+
+public:
+	BarPlanner(int separatorWidth = 9) : separatorWidth(separatorWidth) {};
+
+	// Regroups the bars if they or the masks (one per item) changed, returning true if so. Surfaces and
+	// their cached layouts are only valid until the next regroup.
+	bool plan(const std::vector<BarGeometry>& bars, const std::vector<BarMask>& masks);
+
+	// Lays out every surface from its share of `items`, one per mask given to `plan`. `changed` gets
+	// whether each surface's layout changed.
+	void layout(const std::vector<LayoutItem>& items, std::vector<bool>& changed);
+
+	const std::vector<BarSurface>& get() const {
+		return surfaces;
+	}
+
+	// Bars as of the last plan
+	size_t barCount() const {
+		return barSurfaces.size();
+	}
+
+	size_t surfaceOf(size_t bar) const {
+		return barSurfaces[bar];
+	}
+};
@@ -0,0 +1,215 @@
+#include "fileio.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FILE_PAGE_SIZE 4096
+#define FILE_TAIL_CHUNK 4096
+
+#ifdef _WIN32
+static std::wstring toWide(const std::string& str)
+{
+	std::wstring wide(MultiByteToWideChar(CP_UTF8, 0, str.c_str(), str.length(), NULL, 0), 0);
+	MultiByteToWideChar(CP_UTF8, 0, str.c_str(), str.length(), wide.data(), wide.size());
+	return wide;
+}
+#endif
+
+static FILE *openFile(const std::string& path)
+{
+#ifdef _WIN32
+	return _wfopen(toWide(path).c_str(), L"rb");
+#else
+	return fopen(path.c_str(), "rb");
+#endif
+}
+
+static bool fail(std::string& error, const std::string& path)
+{
+	error = path + ": " + strerror(errno);
+	return false;
+}
+
+// Maps the whole file, returns false to fall back to reading it
+static bool mapFile(const std::string& path, FileBuffer& out)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileW(toWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		mapping = CreateFileMappingW(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	}
+	CloseHandle(file);
+	if (!mapping) {
+		return false;
+	}
+	void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping); // The view keeps it alive
+	if (!view) {
+		return false;
+	}
+	out.len = size.QuadPart;
+	out.data = (uint8_t*)view;
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	void *view = MAP_FAILED;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		view = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	out.len = st.st_size;
+	out.data = (uint8_t*)view;
+#endif
+	out.mapped = true;
+
+	// Fault every page in now, on this thread
+	uint8_t sum = 0;
+	for (size_t i = 0; i < out.len; i += FILE_PAGE_SIZE) {
+		sum += out.data[i];
+	}
+	volatile uint8_t sink = sum;
+	(void)sink;
+	return true;
+}
+
+bool fileRead(const std::string& path, bool map, FileBuffer& out, std::string& error)
+{
+	if (map && mapFile(path, out)) {
+		return true;
+	}
+	FILE *file = openFile(path);
+	if (!file) {
+		return fail(error, path);
+	}
+
+	// Sized from the file, but keeps going if it grows meanwhile
+	size_t cap = 0;
+	if (!fseeko(file, 0, SEEK_END)) {
+		cap = std::max((int64_t)ftello(file), (int64_t)0);
+		fseeko(file, 0, SEEK_SET);
+	}
+	cap = std::max(cap + 1, (size_t)FILE_PAGE_SIZE);
+	out.data = (uint8_t*)malloc(cap);
+	out.len = 0;
+	while (out.data) {
+		out.len += fread(out.data + out.len, 1, cap - out.len, file);
+		if (out.len < cap) {
+			break;
+		}
+		cap += cap / 2;
+		auto newData = (uint8_t*)realloc(out.data, cap);
+		if (!newData) {
+			free(out.data);
+		}
+		out.data = newData;
+	}
+	bool ok = out.data && !ferror(file);
+	fclose(file);
+	if (!ok) {
+		error = path + ": read failed";
+		fileRelease(out);
+	}
+	return ok;
+}
+
+void fileRelease(FileBuffer& buf)
+{
+	if (buf.mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(buf.data);
+#else
+		munmap(buf.data, buf.len);
+#endif
+	} else {
+		free(buf.data);
+	}
+	buf = FileBuffer();
+}
+
+bool fileStat(const std::string& path, FileStat& out, std::string& error)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_wstat64(toWide(path).c_str(), &st)) {
+		return fail(error, path);
+	}
+	out.mtimeMs = st.st_mtime * (int64_t)1000;
+	out.isFile = (st.st_mode & _S_IFMT) == _S_IFREG;
+	out.isDirectory = (st.st_mode & _S_IFMT) == _S_IFDIR;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st)) {
+		return fail(error, path);
+	}
+	out.mtimeMs = st.st_mtim.tv_sec * (int64_t)1000 + st.st_mtim.tv_nsec / 1000000;
+	out.isFile = S_ISREG(st.st_mode);
+	out.isDirectory = S_ISDIR(st.st_mode);
+#endif
+	out.size = st.st_size;
+	return true;
+}
+
+bool fileTail(const std::string& path, int lines, size_t maxBytes, std::string& out, std::string& error)
+{
+	FILE *file = openFile(path);
+	if (!file) {
+		return fail(error, path);
+	}
+	if (fseeko(file, 0, SEEK_END)) {
+		fclose(file);
+		return fail(error, path);
+	}
+	int64_t end = ftello(file), pos = end;
+
+	// Read chunks backwards until there are enough line breaks, not counting one at the very end
+	std::string tail;
+	int found = 0;
+	size_t start = std::string::npos;
+	while (pos > 0 && start == std::string::npos && tail.size() < maxBytes) {
+		size_t chunk = std::min({(int64_t)FILE_TAIL_CHUNK, pos, (int64_t)(maxBytes - tail.size())});
+		pos -= chunk;
+		std::string buf(chunk, 0);
+		if (fseeko(file, pos, SEEK_SET) || fread(buf.data(), 1, chunk, file) != chunk) {
+			fclose(file);
+			error = path + ": read failed";
+			return false;
+		}
+		tail.insert(0, buf);
+		for (size_t i = chunk; i-- > 0;) {
+			if (tail[i] == '\n' && (int64_t)i != end - pos - 1 && ++found == lines) {
+				start = i + 1;
+				break;
+			}
+		}
+	}
+	fclose(file);
+	out = start == std::string::npos ? std::move(tail) : tail.substr(start);
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Blocking file reads meant to run on worker threads, paths are UTF-8
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A file's contents, either a malloc'd copy or a private copy-on-write mapping
+struct FileBuffer {
+	uint8_t *data = nullptr;
+	size_t len = 0;
+	bool mapped = false;
+};
+
+struct FileStat {
+	uint64_t size;
+	int64_t mtimeMs; // Since the Unix epoch
+	bool isFile, isDirectory;
+};
+
+// Mapped buffers are prefaulted so touching them later doesn't wait on the disk.
+// Empty files are never mapped. Returns false with `error` set.
+bool fileRead(const std::string& path, bool map, FileBuffer& out, std::string& error);
+void fileRelease(FileBuffer& buf);
+
+bool fileStat(const std::string& path, FileStat& out, std::string& error);
+
+// The last `lines` lines, reading backwards from the end but no more than `maxBytes`
+bool fileTail(const std::string& path, int lines, size_t maxBytes, std::string& out, std::string& error);
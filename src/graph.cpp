@@ -0,0 +1,87 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+Graph::Graph(size_t columns, float min, float max) :
+		ring(std::max(columns, (size_t)1)), history(ring.size()), min(min), max(max)
+{
+}
+
+size_t Graph::commit(size_t count)
+{
+	for (size_t i = 0; i < std::min(count, ring.size()); i++) {
+		size_t at = (head + count - 1 - i) % ring.size(); // Only the newest lap survives a wrap
+		history[at] = ring[at];
+	}
+	head = (head + count) % ring.size();
+	committed += count;
+	return head;
+}
+
+size_t Graph::push(float value)
+{
+	ring[head] = value;
+	return commit(1);
+}
+
+static inline uint32_t premultiply(uint32_t rgb, float alpha)
+{
+	uint32_t a = (uint32_t)(alpha * 255 + 0.5f);
+	uint32_t r = (rgb & 0xff) * a / 255, g = ((rgb >> 8) & 0xff) * a / 255, b = ((rgb >> 16) & 0xff) * a / 255;
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Bottom-up bar with an anti-aliased top pixel
+void Graph::drawColumn(int x, float value, float lo, float hi)
+{
+	float filled = std::isfinite(value) && hi > lo ? std::clamp((value - lo) / (hi - lo), 0.0f, 1.0f) * rasterHeight : 0;
+	int full = (int)filled;
+	uint32_t solid = premultiply(rasterColor, 1);
+	uint32_t partial = premultiply(rasterColor, filled - full);
+	int width = ring.size();
+	for (int y = 0; y < rasterHeight; y++) {
+		int fromBottom = rasterHeight - 1 - y;
+		raster[y * width + x] = fromBottom < full ? solid : fromBottom == full ? partial : 0;
+	}
+}
+
+void Graph::render(int height, uint32_t color)
+{
+	height = std::clamp(height, 0, GRAPH_MAX_HEIGHT);
+	size_t width = ring.size();
+	float lo = min, hi = max;
+	if (lo == hi) {
+		auto [minIt, maxIt] = std::minmax_element(history.begin(), history.end());
+		lo = std::min(*minIt, 0.0f);
+		hi = *maxIt;
+	}
+
+	// Anything that changes every column needs a full redraw
+	uint64_t fresh = committed - rendered;
+	bool full = height != rasterHeight || color != rasterColor || lo != rasterMin || hi != rasterMax || fresh >= width;
+	if (!full && !fresh) {
+		return;
+	}
+	if (full) {
+		rasterHeight = height;
+		rasterColor = color;
+		rasterMin = lo;
+		rasterMax = hi;
+		raster.assign(width * height, 0);
+		fresh = width;
+	} else {
+		for (int y = 0; y < height; y++) {
+			uint32_t *row = raster.data() + y * width;
+			memmove(row, row + fresh, (width - fresh) * sizeof(uint32_t));
+		}
+	}
+
+	// The newest sample is just before the head, in the rightmost column
+	for (size_t i = 0; i < fresh; i++) {
+		size_t x = width - fresh + i;
+		drawColumn(x, history[(head + x) % width], lo, hi);
+	}
+	rendered = committed;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Sample history drawn as a bar graph, one column per sample
+//
+// Samples live in a ring that JS writes to directly through an ArrayBuffer. Committing copies them into
+// the history the raster is drawn from, so the renderer never reads memory JS may be writing at the same
+// time: commit and render must only be serialized against each other. The raster is kept between renders
+// and scrolled, so only columns for new samples get drawn.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define GRAPH_MAX_HEIGHT 1024 // Pixels, taller renders are clamped
+
+class Graph {
+	std::vector<float> ring; // Written by JS
+	std::vector<float> history; // Committed samples, what is drawn
+	size_t head = 0; // Where the next sample goes
+	uint64_t committed = 0; // Total samples so far
+	float min, max; // Autoscaled if equal
+
+	std::vector<uint32_t> raster; // Premultiplied BGRA, oldest sample on the left
+	int rasterHeight = 0;
+	uint32_t rasterColor = 0;
+	float rasterMin = 0, rasterMax = 0;
+	uint64_t rendered = 0; // `committed` as of the last render
+
+	void drawColumn(int x, float value, float lo, float hi);
+
+public:
+	Graph(size_t columns, float min, float max);
+
+	float *data() {
+		return ring.data();
+	}
+
+	// Committed samples, in the same ring order as `data`
+	const float *samples() const {
+		return history.data();
+	}
+
+	size_t columns() const {
+		return ring.size();
+	}
+
+	float minValue() const {
+		return min;
+	}
+
+	float maxValue() const {
+		return max;
+	}
+
+	// Marks `count` samples written from the head on as committed, returns the new head
+	size_t commit(size_t count);
+	size_t push(float value);
+
+	// Brings the raster up to date, `color` being RGB. `height` is clamped to 0 to GRAPH_MAX_HEIGHT.
+	void render(int height, uint32_t color);
+
+	const uint32_t *pixels() const {
+		return raster.data();
+	}
+};
@@ -0,0 +1,57 @@
+#include "imagecache.h"
+#include "stats.h"
+
+#include <algorithm>
+
+std::shared_ptr<Image> ImageCache::get(const std::string& path, int size)
+{
+	Key key(path, size);
+	auto it = entries.find(key);
+	if (it != entries.end()) {
+		stats.imageCacheHits.add();
+		lru.splice(lru.begin(), lru, it->second.lru);
+		return it->second.image;
+	}
+
+	stats.imageDecodes.add();
+	std::shared_ptr<Image> image = decode(path, size);
+	if (!image) {
+		return nullptr;
+	}
+	lru.push_front(key);
+	entries.emplace(std::move(key), Entry{ .image = image, .lru = lru.begin() });
+	used += image->bytes();
+
+	// Evicted images stay alive as long as a block still shows them
+	while (used > budget && lru.size() > 1) {
+		auto last = entries.find(lru.back());
+		used -= last->second.image->bytes();
+		entries.erase(last);
+		lru.pop_back();
+	}
+	return image;
+}
+
+void compositeImage(uint32_t *pixels, int width, int height, const Image& image, int x, int y, int clipRight)
+{
+	int x0 = std::max(x, 0), x1 = std::min({x + image.width, clipRight, width});
+	int y0 = std::max(y, 0), y1 = std::min(y + image.height, height);
+	for (int py = y0; py < y1; py++) {
+		const uint32_t *src = image.pixels.data() + (py - y) * image.width - x;
+		uint32_t *dst = pixels + py * width;
+		for (int px = x0; px < x1; px++) {
+			uint32_t s = src[px], d = dst[px];
+			uint32_t inv = 255 - (s >> 24);
+			if (inv == 255) {
+				continue;
+			}
+			// Source over, per 8-bit channel
+			uint32_t out = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				uint32_t c = ((s >> shift) & 0xff) + ((d >> shift) & 0xff) * inv / 255;
+				out |= std::min(c, (uint32_t)255) << shift;
+			}
+			dst[px] = out;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Decoded images shared by path and size, with recently used ones kept within a memory budget
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Image {
+	int width, height;
+	std::vector<uint32_t> pixels; // Premultiplied BGRA
+
+	size_t bytes() const {
+		return pixels.size() * sizeof(uint32_t);
+	}
+};
+
+class ImageCache {
+public:
+	using Key = std::pair<std::string, int>;
+	using Decoder = std::shared_ptr<Image> (*)(const std::string& path, int size);
+
+	ImageCache(size_t budget, Decoder decode) : budget(budget), decode(decode) {};
+
+	// Decodes only on a miss, null if decoding failed
+	std::shared_ptr<Image> get(const std::string& path, int size);
+
+	size_t usedBytes() const {
+		return used;
+	}
+
+private:
+	struct Entry {
+		std::shared_ptr<Image> image;
+		std::list<Key>::iterator lru;
+	};
+
+	size_t budget, used = 0;
+	Decoder decode;
+	std::map<Key, Entry> entries;
+	std::list<Key> lru; // Most recently used first
+};
+
+// Draws `image` over premultiplied `pixels` with its top left at x, y, clipped to `clipRight`
+void compositeImage(uint32_t *pixels, int width, int height, const Image& image, int x, int y, int clipRight);
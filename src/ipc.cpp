@@ -0,0 +1,449 @@
+#include "ipc.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define IPC_READ_SIZE 65536 // Per client and wakeup, bounds how long a batch holds the receiver's lock
+#define IPC_MAX_CLIENTS 63
+
+static inline size_t frameLength(const char *data)
+{
+	return (uint8_t)data[0] | (uint8_t)data[1] << 8;
+}
+
+ptrdiff_t IpcDecoder::decodeFrame(const char *data, size_t len, std::vector<IpcMessage>& out)
+{
+	if (len < 2) {
+		return 0;
+	}
+	size_t frameLen = frameLength(data);
+	if (frameLen < 2) {
+		return -1;
+	}
+	if (len < 2 + frameLen) {
+		return 0;
+	}
+
+	auto op = (IpcOp)data[2];
+	size_t nameLen = (uint8_t)data[3];
+	if (!nameLen || 2 + nameLen > frameLen) {
+		return -1;
+	}
+	size_t valueLen = frameLen - 2 - nameLen;
+	switch (op) {
+	case IpcOp::Text:
+		break;
+	case IpcOp::Color:
+		if (valueLen != 3) {
+			return -1;
+		}
+		break;
+	case IpcOp::Visible:
+		if (valueLen != 1) {
+			return -1;
+		}
+		break;
+	case IpcOp::Remove:
+		if (valueLen) {
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+	out.push_back({op, std::string(data + 4, nameLen), std::string(data + 4 + nameLen, valueLen)});
+	return 2 + frameLen;
+}
+
+bool IpcDecoder::feed(const char *data, size_t len, std::vector<IpcMessage>& out)
+{
+	// Finish the frame cut off by the last read
+	while (!pending.empty() && len) {
+		size_t want = pending.size() < 2 ? 2 : 2 + frameLength(pending.data());
+		size_t take = std::min(want - pending.size(), len);
+		pending.append(data, take);
+		data += take;
+		len -= take;
+		if (pending.size() == 2 && frameLength(pending.data()) < 2) {
+			return false;
+		}
+		if (pending.size() == want && want > 2) {
+			if (decodeFrame(pending.data(), pending.size(), out) < 0) {
+				return false;
+			}
+			pending.clear();
+		}
+	}
+
+	// The rest is decoded in place
+	while (len) {
+		ptrdiff_t used = decodeFrame(data, len, out);
+		if (used < 0) {
+			return false;
+		}
+		if (!used) {
+			pending.assign(data, len);
+			break;
+		}
+		data += used;
+		len -= used;
+	}
+	return true;
+}
+
+bool ipcEncode(std::string& out, IpcOp op, std::string_view name, std::string_view value)
+{
+	size_t frameLen = 2 + name.size() + value.size();
+	if (name.empty() || name.size() > 255 || frameLen > IPC_MAX_FRAME) {
+		return false;
+	}
+	out += (char)(frameLen & 0xff);
+	out += (char)(frameLen >> 8);
+	out += (char)op;
+	out += (char)name.size();
+	out += name;
+	out += value;
+	return true;
+}
+
+static void handleBatch(const IpcHandler& handler, std::vector<IpcMessage>& batch)
+{
+	if (batch.empty()) {
+		return;
+	}
+	stats.ipcMessages.add(batch.size());
+	stats.ipcBatches.add();
+	handler(batch);
+	batch.clear();
+}
+
+#ifdef _WIN32
+
+std::string ipcDefaultEndpoint()
+{
+	return "\\\\.\\pipe\\wblocks2";
+}
+
+struct PipeInstance {
+	HANDLE pipe;
+	OVERLAPPED ov;
+	bool connected = false;
+	bool ioPending = false; // The event fires for `ov`, otherwise it was set by hand
+	IpcDecoder decoder;
+	char buf[IPC_READ_SIZE];
+};
+
+// The first instance fails if another process already serves the name, rather than sharing its clients
+static HANDLE createPipe(const std::string& endpoint, bool first)
+{
+	return CreateNamedPipeA(endpoint.c_str(),
+			PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			PIPE_UNLIMITED_INSTANCES, 0, IPC_READ_SIZE, 0, NULL);
+}
+
+// Waits for the next client on the instance, its event fires once one connects
+static bool pipeListen(PipeInstance *inst)
+{
+	if (inst->connected) {
+		DisconnectNamedPipe(inst->pipe);
+	}
+	inst->connected = false;
+	inst->decoder = IpcDecoder();
+	HANDLE event = inst->ov.hEvent;
+	inst->ov = {};
+	inst->ov.hEvent = event;
+	inst->ioPending = false;
+	if (!ConnectNamedPipe(inst->pipe, &inst->ov)) {
+		switch (GetLastError()) {
+		case ERROR_IO_PENDING:
+			inst->ioPending = true;
+			return true;
+		case ERROR_PIPE_CONNECTED:
+			SetEvent(inst->ov.hEvent);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool pipeRead(PipeInstance *inst)
+{
+	inst->ioPending = true;
+	return ReadFile(inst->pipe, inst->buf, sizeof(inst->buf), NULL, &inst->ov) || GetLastError() == ERROR_IO_PENDING;
+}
+
+static void servePipe(std::string endpoint, std::unique_ptr<PipeInstance> first, IpcHandler handler)
+{
+	std::vector<std::unique_ptr<PipeInstance>> instances;
+	instances.push_back(std::move(first));
+	std::vector<HANDLE> events;
+	std::vector<IpcMessage> batch;
+	while (true) {
+		events.clear();
+		for (auto& inst : instances) {
+			events.push_back(inst->ov.hEvent);
+		}
+		WaitForMultipleObjects(events.size(), events.data(), FALSE, INFINITE);
+
+		// Take everything that completed, not just the first
+		bool listening = false;
+		for (auto& inst : instances) {
+			if (WaitForSingleObject(inst->ov.hEvent, 0) != WAIT_OBJECT_0) {
+				listening |= !inst->connected;
+				continue;
+			}
+			DWORD n = 0;
+			bool ok = !inst->ioPending || GetOverlappedResult(inst->pipe, &inst->ov, &n, FALSE);
+			ResetEvent(inst->ov.hEvent);
+			if (!inst->connected) {
+				inst->connected = ok;
+				if (!ok || !pipeRead(inst.get())) {
+					pipeListen(inst.get());
+					listening = true;
+				}
+				continue;
+			}
+			if (ok && !inst->decoder.feed(inst->buf, n, batch)) {
+				stats.ipcRejected.add();
+				ok = false;
+			}
+			if (!ok || !pipeRead(inst.get())) {
+				pipeListen(inst.get());
+				listening = true;
+			}
+		}
+
+		// Always keep one instance free for the next client
+		if (!listening && instances.size() < MAXIMUM_WAIT_OBJECTS) {
+			auto inst = std::make_unique<PipeInstance>();
+			inst->pipe = createPipe(endpoint, false);
+			inst->ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+			if (inst->pipe != INVALID_HANDLE_VALUE && inst->ov.hEvent && pipeListen(inst.get())) {
+				instances.push_back(std::move(inst));
+			}
+		}
+
+		handleBatch(handler, batch);
+	}
+}
+
+bool ipcListen(const std::string& endpoint, IpcHandler handler, std::string& err)
+{
+	auto inst = std::make_unique<PipeInstance>();
+	inst->pipe = createPipe(endpoint, true);
+	if (inst->pipe == INVALID_HANDLE_VALUE) {
+		err = "failed to create pipe " + endpoint;
+		return false;
+	}
+	inst->ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (!inst->ov.hEvent || !pipeListen(inst.get())) {
+		err = "failed to listen on pipe " + endpoint;
+		CloseHandle(inst->pipe);
+		return false;
+	}
+	std::thread(servePipe, endpoint, std::move(inst), std::move(handler)).detach();
+	return true;
+}
+
+IpcClient::~IpcClient()
+{
+	if (pipe) {
+		CloseHandle(pipe);
+	}
+}
+
+bool IpcClient::connect(const std::string& endpoint, std::string& err)
+{
+	while (true) {
+		HANDLE h = CreateFileA(endpoint.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (h != INVALID_HANDLE_VALUE) {
+			pipe = h;
+			return true;
+		}
+		// Every instance is taken until the server gets around to making another
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(endpoint.c_str(), 2000)) {
+			err = "failed to connect to " + endpoint;
+			return false;
+		}
+	}
+}
+
+bool IpcClient::send(std::string_view frames)
+{
+	while (!frames.empty()) {
+		DWORD n;
+		if (!WriteFile(pipe, frames.data(), std::min(frames.size(), (size_t)IPC_READ_SIZE), &n, NULL)) {
+			return false;
+		}
+		frames.remove_prefix(n);
+	}
+	return true;
+}
+
+#else
+
+std::string ipcDefaultEndpoint()
+{
+	const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+	if (runtimeDir && *runtimeDir) {
+		return std::string(runtimeDir) + "/wblocks2.sock";
+	}
+	return "/tmp/wblocks2-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool socketAddress(const std::string& endpoint, sockaddr_un& addr, std::string& err)
+{
+	addr = {};
+	addr.sun_family = AF_UNIX;
+	if (endpoint.size() >= sizeof(addr.sun_path)) {
+		err = "socket path too long: " + endpoint;
+		return false;
+	}
+	memcpy(addr.sun_path, endpoint.c_str(), endpoint.size() + 1);
+	return true;
+}
+
+struct SocketClient {
+	int fd;
+	IpcDecoder decoder;
+};
+
+static void serveSocket(int listenFd, IpcHandler handler)
+{
+	std::vector<SocketClient> clients;
+	std::vector<pollfd> fds;
+	std::vector<IpcMessage> batch;
+	auto buf = std::make_unique<char[]>(IPC_READ_SIZE);
+	while (true) {
+		fds.clear();
+		fds.push_back({ .fd = listenFd, .events = POLLIN });
+		for (SocketClient& client : clients) {
+			fds.push_back({ .fd = client.fd, .events = POLLIN });
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			continue; // EINTR
+		}
+
+		// Fds line up with `clients` until new ones are accepted at the end
+		size_t polled = clients.size();
+		for (size_t i = polled; i-- > 0;) {
+			if (!fds[i + 1].revents) {
+				continue;
+			}
+			ssize_t n = read(clients[i].fd, buf.get(), IPC_READ_SIZE);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			if (n > 0 && clients[i].decoder.feed(buf.get(), n, batch)) {
+				continue;
+			}
+			if (n > 0) {
+				stats.ipcRejected.add();
+			}
+			close(clients[i].fd);
+			clients.erase(clients.begin() + i);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd;
+			while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+				if (clients.size() >= IPC_MAX_CLIENTS) {
+					close(fd);
+					continue;
+				}
+				clients.push_back({ .fd = fd });
+			}
+		}
+
+		handleBatch(handler, batch);
+	}
+}
+
+bool ipcListen(const std::string& endpoint, IpcHandler handler, std::string& err)
+{
+	sockaddr_un addr;
+	if (!socketAddress(endpoint, addr, err)) {
+		return false;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		err = strerror(errno);
+		return false;
+	}
+
+	// A socket left behind by a crash is replaced, one that still has a server is not
+	IpcClient probe;
+	std::string probeErr;
+	if (probe.connect(endpoint, probeErr)) {
+		close(fd);
+		err = endpoint + " is already in use";
+		return false;
+	}
+	unlink(endpoint.c_str());
+
+	mode_t mask = umask(0077);
+	bool bound = !bind(fd, (sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+	if (!bound || listen(fd, SOMAXCONN)) {
+		err = endpoint + ": " + strerror(errno);
+		close(fd);
+		return false;
+	}
+	std::thread(serveSocket, fd, std::move(handler)).detach();
+	return true;
+}
+
+IpcClient::~IpcClient()
+{
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+bool IpcClient::connect(const std::string& endpoint, std::string& err)
+{
+	sockaddr_un addr;
+	if (!socketAddress(endpoint, addr, err)) {
+		return false;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+		err = endpoint + ": " + strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+bool IpcClient::send(std::string_view frames)
+{
+	while (!frames.empty()) {
+		ssize_t n = ::send(fd, frames.data(), frames.size(), MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		frames.remove_prefix(n);
+	}
+	return true;
+}
+
+#endif
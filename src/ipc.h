@@ -0,0 +1,70 @@
+#pragma once
+
+// Local endpoint other processes push block updates to
+//
+// A named pipe on Windows and a Unix socket on POSIX, served by one thread that waits on every
+// client at once. Everything that arrived in one wakeup is handed over as a single batch, so the
+// receiver takes its lock once per batch rather than per update.
+//
+// Each update is a frame:
+//   u16 length of the rest (little endian), u8 op, u8 name length, name, value
+// with the value being UTF-8 text for `Text`, 3 bytes of RGB for `Color`, 1 byte for `Visible` and none for
+// `Remove`.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define IPC_MAX_FRAME 65535
+
+enum class IpcOp : uint8_t { Text = 1, Color = 2, Visible = 3, Remove = 4 };
+
+struct IpcMessage {
+	IpcOp op;
+	std::string name;
+	std::string value;
+};
+
+// Splits a byte stream into messages, frames may be cut anywhere between reads
+class IpcDecoder {
+	std::string pending; // Start of an incomplete frame
+
+	// Returns the bytes used, 0 if `data` doesn't hold a whole frame, -1 if it is malformed
+	static ptrdiff_t decodeFrame(const char *data, size_t len, std::vector<IpcMessage>& out);
+
+public:
+	// Appends the complete messages in `data` to `out`, false on a malformed frame
+	bool feed(const char *data, size_t len, std::vector<IpcMessage>& out);
+};
+
+// Appends a frame, false if the name or value is too long for one
+bool ipcEncode(std::string& out, IpcOp op, std::string_view name, std::string_view value);
+
+// Named pipe or socket path for this user
+std::string ipcDefaultEndpoint();
+
+using IpcHandler = std::function<void(std::vector<IpcMessage>& batch)>;
+
+// Creates the endpoint and serves it on a detached thread that calls `handler` with each batch.
+// Clients sending malformed frames are dropped.
+bool ipcListen(const std::string& endpoint, IpcHandler handler, std::string& err);
+
+// Blocking writer for tools pushing updates
+class IpcClient {
+#ifdef _WIN32
+	void *pipe = nullptr;
+#else
+	int fd = -1;
+#endif
+
+public:
+	~IpcClient();
+
+	bool connect(const std::string& endpoint, std::string& err);
+
+	// Writes all of `frames`
+	bool send(std::string_view frames);
+};
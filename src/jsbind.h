@@ -0,0 +1,192 @@
+#pragma once
+
+// Argument checking and conversion for native functions, generated from the signature of the C++ setter
+// they call
+//
+//   static void blockSetPadding(Block *block, int left, int right);
+//   jsCallSetter<blockSetPadding>(ctx, block, argc, argv); // TypeError unless given exactly two numbers
+//
+// Numbers tagged as ints are read as they are, doubles are truncated towards zero and saturated instead of
+// having their bits read as an int. Setters return void, an error message (NULL on success) thrown as
+// an InternalError, or a `JSRangeError` for arguments that are fine alone but not together.
+
+#include <quickjs/quickjs.h>
+
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Returned by conversions for a value of the wrong type, thrown as a TypeError. Any other message is a
+// value of the right type out of range, thrown as a RangeError.
+inline constexpr const char *jsArgInvalid = "Invalid argument";
+
+// Converts one argument, NULL on success. Specialize for other parameter types.
+template<typename T>
+struct JSArg;
+
+template<>
+struct JSArg<int> {
+	static const char *get(JSContext *ctx, JSValueConst val, int& out) {
+		int tag = JS_VALUE_GET_TAG(val);
+		if (tag == JS_TAG_INT) {
+			out = JS_VALUE_GET_INT(val);
+			return NULL;
+		}
+		if (!JS_TAG_IS_FLOAT64(tag)) {
+			return jsArgInvalid;
+		}
+		double d = JS_VALUE_GET_FLOAT64(val);
+		out = std::isnan(d) ? 0 : d <= INT_MIN ? INT_MIN : d >= INT_MAX ? INT_MAX : (int)d;
+		return NULL;
+	}
+};
+
+template<>
+struct JSArg<double> {
+	static const char *get(JSContext *ctx, JSValueConst val, double& out) {
+		int tag = JS_VALUE_GET_TAG(val);
+		if (tag == JS_TAG_INT) {
+			out = JS_VALUE_GET_INT(val);
+		} else if (JS_TAG_IS_FLOAT64(tag)) {
+			out = JS_VALUE_GET_FLOAT64(val);
+		} else {
+			return jsArgInvalid;
+		}
+		return NULL;
+	}
+};
+
+template<>
+struct JSArg<bool> {
+	static const char *get(JSContext *ctx, JSValueConst val, bool& out) {
+		if (!JS_IsBool(val)) {
+			return jsArgInvalid;
+		}
+		out = JS_VALUE_GET_BOOL(val);
+		return NULL;
+	}
+};
+
+template<>
+struct JSArg<std::string> {
+	static const char *get(JSContext *ctx, JSValueConst val, std::string& out) {
+		size_t len;
+		const char *str = JS_IsString(val) ? JS_ToCStringLen(ctx, &len, val) : NULL;
+		if (!str) {
+			return jsArgInvalid;
+		}
+		out.assign(str, len);
+		JS_FreeCString(ctx, str);
+		return NULL;
+	}
+};
+
+// Returned by setters checking their arguments against each other, `message` NULL on success
+struct JSRangeError {
+	const char *message;
+};
+
+template<typename F>
+struct JSSetter;
+
+template<typename R, typename Self, typename... Args>
+struct JSSetter<R (*)(Self*, Args...)> {
+	static constexpr int arity = sizeof...(Args);
+	using Values = std::tuple<std::decay_t<Args>...>;
+
+	// Returns JS_EXCEPTION if a value is bad
+	template<size_t... I>
+	static JSValue convert(JSContext *ctx, JSValueConst *argv, Values& values, std::index_sequence<I...>) {
+		const char *err = NULL;
+
+		// Left to right, stopping at the first bad one
+		(void)(((err = JSArg<std::decay_t<Args>>::get(ctx, argv[I], std::get<I>(values))) == NULL) && ...);
+		if (err) {
+			return err == jsArgInvalid ? JS_ThrowTypeError(ctx, "%s", err) : JS_ThrowRangeError(ctx, "%s", err);
+		}
+		return JS_UNDEFINED;
+	}
+
+	template<auto setter>
+	static JSValue apply(JSContext *ctx, Self *self, Values& values) {
+		if constexpr (std::is_void_v<R>) {
+			std::apply([&](auto&... value) { setter(self, std::move(value)...); }, values);
+			return JS_UNDEFINED;
+		} else if constexpr (std::is_same_v<R, JSRangeError>) {
+			JSRangeError err = std::apply([&](auto&... value) { return setter(self, std::move(value)...); }, values);
+			return err.message ? JS_ThrowRangeError(ctx, "%s", err.message) : JS_UNDEFINED;
+		} else {
+			static_assert(std::is_same_v<R, const char*>, "Setters return void, an error message or a JSRangeError");
+			const char *failed = std::apply([&](auto&... value) { return setter(self, std::move(value)...); }, values);
+			return failed ? JS_ThrowInternalError(ctx, "%s", failed) : JS_UNDEFINED;
+		}
+	}
+};
+
+// Number of JS arguments `setter` takes, for `JS_NewCFunction`
+template<auto setter>
+inline constexpr int jsSetterArity = JSSetter<decltype(setter)>::arity;
+
+// Checks `argv` against the parameters of `setter`, converting them into `values`
+template<auto setter>
+JSValue jsSetterArgs(JSContext *ctx, int argc, JSValueConst *argv, typename JSSetter<decltype(setter)>::Values& values)
+{
+	using S = JSSetter<decltype(setter)>;
+	if (argc != S::arity) {
+		return JS_ThrowTypeError(ctx, "%s", jsArgInvalid);
+	}
+	return S::convert(ctx, argv, values, std::make_index_sequence<S::arity>());
+}
+
+// Checks `argv` against the parameters of `setter` after `self` and calls it with the converted values. The
+// call is made through `wrap(call)`, which can take a lock: converting objects may run JS, so it's done before.
+template<auto setter, typename Self, typename Wrap>
+JSValue jsCallSetter(JSContext *ctx, Self *self, int argc, JSValueConst *argv, Wrap&& wrap)
+{
+	using S = JSSetter<decltype(setter)>;
+	typename S::Values values;
+	if (JS_IsException(jsSetterArgs<setter>(ctx, argc, argv, values))) {
+		return JS_EXCEPTION;
+	}
+	return wrap([&] { return S::template apply<setter>(ctx, self, values); });
+}
+
+template<auto setter, typename Self>
+JSValue jsCallSetter(JSContext *ctx, Self *self, int argc, JSValueConst *argv)
+{
+	return jsCallSetter<setter>(ctx, self, argc, argv, [](auto call) { return call(); });
+}
+
+// Setter call with its arguments already converted, to be made later
+using JSBoundSetter = std::function<JSValue()>;
+
+// Setter reachable by property name, for setting many things with one call
+template<typename Self>
+struct JSSetterProp {
+	const char *name;
+	int arity; // Arrays of this many arguments are taken when more than 1
+	JSValue (*bind)(JSContext *ctx, Self *self, int argc, JSValueConst *argv, JSBoundSetter& bound);
+};
+
+// Converts `argv` for `setter` into `bound`, returning JS_EXCEPTION if a value is bad
+template<auto setter, typename Self>
+JSValue jsBindSetter(JSContext *ctx, Self *self, int argc, JSValueConst *argv, JSBoundSetter& bound)
+{
+	using S = JSSetter<decltype(setter)>;
+	typename S::Values values;
+	if (JS_IsException(jsSetterArgs<setter>(ctx, argc, argv, values))) {
+		return JS_EXCEPTION;
+	}
+	bound = [ctx, self, values = std::move(values)]() mutable { return S::template apply<setter>(ctx, self, values); };
+	return JS_UNDEFINED;
+}
+
+template<auto setter, typename Self>
+constexpr JSSetterProp<Self> jsSetterProp(const char *name)
+{
+	return { name, jsSetterArity<setter>, jsBindSetter<setter, Self> };
+}
@@ -0,0 +1,90 @@
+#include "jsmem.h"
+#include "scripts.h"
+
+#include <cstdlib>
+
+#define JSMEM_OVERHEAD 8 // Same estimate of malloc bookkeeping QuickJS uses
+
+// Kept in front of every allocation, 16 bytes so alignment is preserved
+struct AllocHeader {
+	uint32_t script;
+	uint32_t reserved;
+	size_t size;
+};
+
+static inline AllocHeader *headerOf(const void *ptr)
+{
+	return (AllocHeader*)ptr - 1;
+}
+
+static inline void account(uint32_t script, int64_t bytes, int64_t allocs)
+{
+	scriptInfos[script].heapBytes.fetch_add(bytes, std::memory_order_relaxed);
+	scriptInfos[script].heapAllocs.fetch_add(allocs, std::memory_order_relaxed);
+}
+
+static void *jsMemMalloc(JSMallocState *s, size_t size)
+{
+	if (s->malloc_size + size > s->malloc_limit) {
+		return nullptr;
+	}
+	auto header = (AllocHeader*)malloc(sizeof(AllocHeader) + size);
+	if (!header) {
+		return nullptr;
+	}
+	header->script = currentScript;
+	header->size = size;
+	s->malloc_count++;
+	s->malloc_size += size + JSMEM_OVERHEAD;
+	account(header->script, size, 1);
+	return header + 1;
+}
+
+static void jsMemFree(JSMallocState *s, void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	AllocHeader *header = headerOf(ptr);
+	s->malloc_count--;
+	s->malloc_size -= header->size + JSMEM_OVERHEAD;
+	account(header->script, -(int64_t)header->size, -1);
+	free(header);
+}
+
+// Keeps the original owner, it's charged for the growth too
+static void *jsMemRealloc(JSMallocState *s, void *ptr, size_t size)
+{
+	if (!ptr) {
+		return size ? jsMemMalloc(s, size) : nullptr;
+	}
+	if (!size) {
+		jsMemFree(s, ptr);
+		return nullptr;
+	}
+	AllocHeader *header = headerOf(ptr);
+	size_t oldSize = header->size;
+	if (s->malloc_size + size - oldSize > s->malloc_limit) {
+		return nullptr;
+	}
+	header = (AllocHeader*)realloc(header, sizeof(AllocHeader) + size);
+	if (!header) {
+		return nullptr;
+	}
+	header->size = size;
+	s->malloc_size += size - oldSize;
+	account(header->script, (int64_t)size - (int64_t)oldSize, 0);
+	return header + 1;
+}
+
+static size_t jsMemUsableSize(const void *ptr)
+{
+	return ptr ? headerOf(ptr)->size : 0;
+}
+
+const JSMallocFunctions jsMemFunctions = {
+	.js_malloc = jsMemMalloc,
+	.js_free = jsMemFree,
+	.js_realloc = jsMemRealloc,
+	.js_malloc_usable_size = jsMemUsableSize,
+};
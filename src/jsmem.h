@@ -0,0 +1,7 @@
+#pragma once
+
+// QuickJS allocator attributing every allocation to `currentScript`
+
+#include <quickjs/quickjs.h>
+
+extern const JSMallocFunctions jsMemFunctions;
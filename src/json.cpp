@@ -0,0 +1,323 @@
+#include "json.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#define JSON_MAX_DEPTH 512
+#define JSON_MAX_KEY_INTERN 32 // Longer keys are rarely repeated
+#define JSON_MAX_KEYS 4096 // Stop interning objects used as big maps
+
+struct JsonParser {
+	JsonDoc& doc;
+	const char *p, *end, *start;
+	std::string& error;
+
+	bool fail(const char *msg) {
+		error = std::string(msg) + " at offset " + std::to_string(p - start);
+		return false;
+	}
+
+	void skipSpace() {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+			p++;
+		}
+	}
+
+	bool literal(const char *word, JsonType type) {
+		size_t len = strlen(word);
+		if ((size_t)(end - p) < len || memcmp(p, word, len)) {
+			return fail("Invalid literal");
+		}
+		p += len;
+		doc.push(type);
+		return true;
+	}
+
+	static int hexDigit(char c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	bool hex4(uint32_t& out) {
+		if (end - p < 4) {
+			return fail("Truncated escape");
+		}
+		out = 0;
+		for (int i = 0; i < 4; i++) {
+			int d = hexDigit(*p++);
+			if (d < 0) {
+				return fail("Invalid escape");
+			}
+			out = out << 4 | d;
+		}
+		return true;
+	}
+
+	void appendUtf8(uint32_t c) {
+		std::string& s = doc.strings;
+		if (c < 0x80) {
+			s += (char)c;
+		} else if (c < 0x800) {
+			s += (char)(0xc0 | c >> 6);
+			s += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			s += (char)(0xe0 | c >> 12);
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		} else {
+			s += (char)(0xf0 | c >> 18);
+			s += (char)(0x80 | ((c >> 12) & 0x3f));
+			s += (char)(0x80 | ((c >> 6) & 0x3f));
+			s += (char)(0x80 | (c & 0x3f));
+		}
+	}
+
+	bool string(bool key = false) {
+		p++; // Opening quote
+		uint32_t i = doc.push(JsonType::String);
+		uint32_t offset = doc.strings.size();
+		while (true) {
+			// Copy the run up to the next quote, escape or control character in one go
+			const char *run = p;
+			while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) {
+				p++;
+			}
+			doc.strings.append(run, p - run);
+			if (p >= end) {
+				return fail("Unterminated string");
+			}
+			if (*p == '"') {
+				p++;
+				break;
+			}
+			if (*p != '\\') {
+				return fail("Control character in string");
+			}
+			if (++p >= end) {
+				return fail("Truncated escape");
+			}
+			char c = *p++;
+			switch (c) {
+			case '"': case '\\': case '/': doc.strings += c; break;
+			case 'b': doc.strings += '\b'; break;
+			case 'f': doc.strings += '\f'; break;
+			case 'n': doc.strings += '\n'; break;
+			case 'r': doc.strings += '\r'; break;
+			case 't': doc.strings += '\t'; break;
+			case 'u': {
+				uint32_t cp = 0;
+				if (!hex4(cp)) {
+					return false;
+				}
+				// Combine surrogate pairs, lone surrogates have no UTF-8 form and become U+FFFD
+				if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+					const char *save = p;
+					p += 2;
+					uint32_t low = 0;
+					if (!hex4(low)) {
+						return false;
+					}
+					if (low >= 0xdc00 && low < 0xe000) {
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					} else {
+						p = save;
+					}
+				}
+				appendUtf8(cp >= 0xd800 && cp < 0xe000 ? 0xfffd : cp);
+				break;
+			}
+			default:
+				return fail("Invalid escape");
+			}
+		}
+		JsonNode& node = doc.nodes[i];
+		node.value = offset;
+		node.size = doc.strings.size() - offset;
+		if (key && node.size <= JSON_MAX_KEY_INTERN) {
+			std::string_view text(doc.strings.data() + offset, node.size);
+			auto it = doc.keys.find(text);
+			if (it != doc.keys.end()) {
+				node.value = it->second;
+				doc.strings.resize(offset);
+			} else if (doc.keys.size() < JSON_MAX_KEYS) {
+				doc.keys.emplace(text, offset);
+			}
+		}
+		return true;
+	}
+
+	bool number() {
+		const char *s = p;
+		if (p < end && *p == '-') p++;
+		if (p >= end || *p < '0' || *p > '9') {
+			return fail("Invalid number");
+		}
+		if (*p == '0') {
+			p++;
+		} else {
+			while (p < end && *p >= '0' && *p <= '9') p++;
+		}
+		if (p < end && *p == '.') {
+			p++;
+			if (p >= end || *p < '0' || *p > '9') {
+				return fail("Invalid number");
+			}
+			while (p < end && *p >= '0' && *p <= '9') p++;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			p++;
+			if (p < end && (*p == '+' || *p == '-')) p++;
+			if (p >= end || *p < '0' || *p > '9') {
+				return fail("Invalid number");
+			}
+			while (p < end && *p >= '0' && *p <= '9') p++;
+		}
+		// strtod needs a terminator, numbers are short so copy them out
+		char buf[64];
+		std::string big;
+		const char *digits = buf;
+		size_t len = p - s;
+		if (len < sizeof(buf)) {
+			memcpy(buf, s, len);
+			buf[len] = 0;
+		} else {
+			big.assign(s, len);
+			digits = big.c_str();
+		}
+		doc.nodes[doc.push(JsonType::Number)].value = doc.numbers.size();
+		doc.numbers.push_back(strtod(digits, nullptr));
+		return true;
+	}
+
+	bool value(int depth) {
+		if (depth > JSON_MAX_DEPTH) {
+			return fail("Nested too deep");
+		}
+		skipSpace();
+		if (p >= end) {
+			return fail("Unexpected end");
+		}
+		switch (*p) {
+		case '{': case '[': {
+			bool object = *p == '{';
+			char close = object ? '}' : ']';
+			uint32_t i = doc.push(object ? JsonType::Object : JsonType::Array);
+			uint32_t count = 0;
+			p++;
+			skipSpace();
+			if (p < end && *p == close) {
+				p++;
+			} else {
+				while (true) {
+					if (object) {
+						skipSpace();
+						if (p >= end || *p != '"') {
+							return fail("Expected key");
+						}
+						if (!string(true)) {
+							return false;
+						}
+						skipSpace();
+						if (p >= end || *p != ':') {
+							return fail("Expected ':'");
+						}
+						p++;
+					}
+					if (!value(depth + 1)) {
+						return false;
+					}
+					count++;
+					skipSpace();
+					if (p < end && *p == ',') {
+						p++;
+					} else if (p < end && *p == close) {
+						p++;
+						break;
+					} else {
+						return fail(object ? "Expected ',' or '}'" : "Expected ',' or ']'");
+					}
+				}
+			}
+			doc.nodes[i].size = count;
+			doc.nodes[i].next = doc.nodes.size();
+			return true;
+		}
+		case '"': return string();
+		case 't': return literal("true", JsonType::True);
+		case 'f': return literal("false", JsonType::False);
+		case 'n': return literal("null", JsonType::Null);
+		default: return number();
+		}
+	}
+};
+
+uint32_t JsonDoc::push(JsonType type)
+{
+	nodes.push_back({ .type = type, .size = 0, .next = (uint32_t)nodes.size() + 1, .value = 0 });
+	return nodes.size() - 1;
+}
+
+bool JsonDoc::parse(const char *text, size_t len, std::string& error)
+{
+	nodes.clear();
+	numbers.clear();
+	strings.clear();
+	keys.clear();
+
+	JsonParser parser{ .doc = *this, .p = text, .end = text + len, .start = text, .error = error };
+	// Tolerate a UTF-8 BOM, PowerShell likes to write one
+	if (len >= 3 && !memcmp(text, "\xef\xbb\xbf", 3)) {
+		parser.p += 3;
+	}
+	if (!parser.value(0)) {
+		return false;
+	}
+	parser.skipSpace();
+	if (parser.p != parser.end) {
+		return parser.fail("Trailing characters");
+	}
+	return true;
+}
+
+uint32_t JsonDoc::select(std::string_view path) const
+{
+	uint32_t i = 0;
+	while (!path.empty()) {
+		size_t dot = path.find('.');
+		std::string_view part = path.substr(0, dot);
+		path = dot == std::string_view::npos ? std::string_view() : path.substr(dot + 1);
+
+		const JsonNode& parent = nodes[i];
+		uint32_t child = i + 1;
+		if (parent.type == JsonType::Array) {
+			char *partEnd;
+			std::string index(part);
+			unsigned long n = strtoul(index.c_str(), &partEnd, 10);
+			if (index.empty() || *partEnd || n >= parent.size) {
+				return JSON_MISSING;
+			}
+			for (unsigned long k = 0; k < n; k++) {
+				child = nodes[child].next;
+			}
+			i = child;
+		} else if (parent.type == JsonType::Object) {
+			uint32_t found = JSON_MISSING;
+			for (uint32_t k = 0; k < parent.size; k++) {
+				uint32_t value = child + 1;
+				if (string(nodes[child]) == part) {
+					found = value; // Last one wins, like JSON.parse
+				}
+				child = nodes[value].next;
+			}
+			if (found == JSON_MISSING) {
+				return JSON_MISSING;
+			}
+			i = found;
+		} else {
+			return JSON_MISSING;
+		}
+	}
+	return i;
+}
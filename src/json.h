@@ -0,0 +1,69 @@
+#pragma once
+
+// JSON parsed into a flat native tree, so it can be parsed off the JS thread
+//
+// Nodes are stored depth-first. An array is followed by its elements, an object by key and
+// value pairs, and every node records where its subtree ends. Strings are unescaped into one
+// UTF-8 buffer, where short object keys are interned so repeated keys share an offset.
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class JsonType : uint8_t { Null, False, True, Number, String, Array, Object };
+
+struct JsonNode {
+	JsonType type;
+	uint32_t size; // Elements or members for arrays and objects, bytes for strings
+	uint32_t next; // Index of the node following this subtree
+	uint32_t value; // Offset into the strings or index into the numbers
+};
+
+#define JSON_MISSING UINT32_MAX
+
+struct JsonKeyHash {
+	using is_transparent = void;
+
+	size_t operator()(std::string_view key) const {
+		return std::hash<std::string_view>()(key);
+	}
+};
+
+class JsonDoc {
+	std::vector<JsonNode> nodes;
+	std::vector<double> numbers;
+	std::string strings;
+	std::unordered_map<std::string, uint32_t, JsonKeyHash, std::equal_to<>> keys; // Interned key offsets
+
+	uint32_t push(JsonType type);
+
+public:
+	// Returns false with `error` set if `text` isn't a single valid JSON value
+	bool parse(const char *text, size_t len, std::string& error);
+
+	const JsonNode& node(uint32_t i) const {
+		return nodes[i];
+	}
+
+	std::string_view string(const JsonNode& node) const {
+		return std::string_view(strings.data() + node.value, node.size);
+	}
+
+	double number(const JsonNode& node) const {
+		return numbers[node.value];
+	}
+
+	// Follows a path of dot separated keys and array indices, like `items.0.name`, from the root.
+	// Returns JSON_MISSING if it leads nowhere.
+	uint32_t select(std::string_view path) const;
+
+	// Bytes held by the tree
+	size_t bytes() const {
+		return nodes.size() * sizeof(JsonNode) + numbers.size() * sizeof(double) + strings.size();
+	}
+
+	friend struct JsonParser;
+};
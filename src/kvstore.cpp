@@ -0,0 +1,363 @@
+#include "kvstore.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define KV_FILE_MAGIC "WBKV0001"
+#define KV_HEADER_SIZE 16
+#define KV_RECORD_MAGIC 0x4b56524bu
+#define KV_FLAG_BINARY 1
+#define KV_FLAG_DELETED 2
+
+struct KVRecord {
+	uint32_t magic; // Written last
+	uint32_t crc; // Of everything after it, including key and value
+	uint32_t keyLen, valueLen;
+	int64_t expiresAt;
+	uint32_t flags, reserved;
+};
+
+static constexpr auto crcTable = [] {
+	std::array<uint32_t, 256> table{};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		table[i] = c;
+	}
+	return table;
+}();
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	auto p = (const uint8_t*)data;
+	crc = ~crc;
+	while (len--) {
+		crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t recordCrc(const KVRecord *rec)
+{
+	const size_t skip = offsetof(KVRecord, keyLen);
+	return crc32(0, (const char*)rec + skip, sizeof(KVRecord) - skip + rec->keyLen + rec->valueLen);
+}
+
+static inline size_t recordSize(size_t keyLen, size_t valueLen)
+{
+	return (sizeof(KVRecord) + keyLen + valueLen + 7) & ~(size_t)7;
+}
+
+static int64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static inline bool isExpired(const KVRecord *rec, int64_t now)
+{
+	return rec->expiresAt && now >= rec->expiresAt;
+}
+
+KVStore::~KVStore()
+{
+	close();
+}
+
+bool KVStore::mapFile(const std::string& path, size_t minSize, Mapping& out)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+			OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	size_t size = std::max((size_t)fileSize.QuadPart, minSize);
+
+	// The mapping grows the file if needed
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+	void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+	if (!data) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	out = { .data = (char*)data, .size = size, .file = file, .mapping = mapping };
+#else
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || ((size_t)st.st_size < minSize && ftruncate(fd, minSize))) {
+		::close(fd);
+		return false;
+	}
+	size_t size = std::max((size_t)st.st_size, minSize);
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+	out = { .data = (char*)data, .size = size, .fd = fd };
+#endif
+	return true;
+}
+
+void KVStore::unmapFile(Mapping& map)
+{
+	if (!map.data) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(map.data);
+	CloseHandle(map.mapping);
+	CloseHandle(map.file);
+#else
+	munmap(map.data, map.size);
+	::close(map.fd);
+#endif
+	map = {};
+}
+
+// Makes sure the data is on disk, only needed before replacing the file
+static void syncMapping(char *data, size_t size, void *file)
+{
+#ifdef _WIN32
+	FlushViewOfFile(data, size);
+	FlushFileBuffers((HANDLE)file);
+#else
+	msync(data, size, MS_SYNC);
+#endif
+}
+
+static bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	return !rename(from.c_str(), to.c_str());
+#endif
+}
+
+bool KVStore::open(const std::string& path, size_t initialSize)
+{
+	close();
+	this->path = path;
+	if (!mapFile(path, std::max(initialSize, (size_t)KV_HEADER_SIZE), map)) {
+		return false;
+	}
+	if (memcmp(map.data, KV_FILE_MAGIC, 8)) {
+		memset(map.data, 0, map.size);
+		memcpy(map.data, KV_FILE_MAGIC, 8);
+	}
+	load();
+	return true;
+}
+
+void KVStore::close()
+{
+	unmapFile(map);
+	index.clear();
+	end = liveBytes = 0;
+}
+
+// Replays the log into the index, stopping at the first torn or corrupt record
+void KVStore::load()
+{
+	end = KV_HEADER_SIZE;
+	while (end + sizeof(KVRecord) <= map.size) {
+		auto rec = (const KVRecord*)(map.data + end);
+		if (rec->magic != KV_RECORD_MAGIC) {
+			break;
+		}
+		size_t size = recordSize(rec->keyLen, rec->valueLen);
+		if (size > map.size - end || recordCrc(rec) != rec->crc) {
+			break;
+		}
+		std::string key(map.data + end + sizeof(KVRecord), rec->keyLen);
+		auto it = index.find(key);
+		if (it != index.end()) {
+			auto old = (const KVRecord*)(map.data + it->second);
+			liveBytes -= recordSize(old->keyLen, old->valueLen);
+			index.erase(it);
+		}
+		if (!(rec->flags & KV_FLAG_DELETED)) {
+			index.emplace(std::move(key), end);
+			liveBytes += size;
+		}
+		end += size;
+	}
+
+	// Anything past the end is garbage from a crash, clear it so appends can't link up with it
+	for (size_t i = end; i < map.size; i++) {
+		if (map.data[i]) {
+			memset(map.data + end, 0, map.size - end);
+			break;
+		}
+	}
+}
+
+bool KVStore::append(Mapping& target, size_t& at, const std::string& key, const void *data, size_t len,
+		uint32_t flags, int64_t expiresAtMs)
+{
+	size_t size = recordSize(key.size(), len);
+	if (size > target.size - at) {
+		return false;
+	}
+	auto rec = (KVRecord*)(target.data + at);
+	rec->keyLen = key.size();
+	rec->valueLen = len;
+	rec->expiresAt = expiresAtMs;
+	rec->flags = flags;
+	rec->reserved = 0;
+	memcpy(target.data + at + sizeof(KVRecord), key.data(), key.size());
+	if (len) {
+		memcpy(target.data + at + sizeof(KVRecord) + key.size(), data, len); // Deletes have no data at all
+	}
+	rec->crc = recordCrc(rec);
+	std::atomic_thread_fence(std::memory_order_release);
+	rec->magic = KV_RECORD_MAGIC;
+	at += size;
+	return true;
+}
+
+// Rewrites live records into a new file, growing it so there is room for `extra` more bytes
+bool KVStore::compact(size_t extra)
+{
+	int64_t now = nowMs();
+	size_t needed = KV_HEADER_SIZE + extra;
+	for (auto& [key, offset] : index) {
+		auto rec = (const KVRecord*)(map.data + offset);
+		if (!isExpired(rec, now)) {
+			needed += recordSize(rec->keyLen, rec->valueLen);
+		}
+	}
+	size_t newSize = map.size;
+	while (newSize < needed * 4) {
+		newSize *= 2;
+	}
+
+	std::string tmpPath = path + ".tmp";
+	::remove(tmpPath.c_str());
+	Mapping tmp;
+	if (!mapFile(tmpPath, newSize, tmp)) {
+		return false;
+	}
+	memcpy(tmp.data, KV_FILE_MAGIC, 8);
+	std::unordered_map<std::string, size_t> newIndex;
+	size_t at = KV_HEADER_SIZE, newLive = 0;
+	for (auto& [key, offset] : index) {
+		auto rec = (const KVRecord*)(map.data + offset);
+		if (isExpired(rec, now)) {
+			continue;
+		}
+		newIndex.emplace(key, at);
+		newLive += recordSize(rec->keyLen, rec->valueLen);
+		append(tmp, at, key, map.data + offset + sizeof(KVRecord) + rec->keyLen, rec->valueLen, rec->flags, rec->expiresAt);
+	}
+#ifdef _WIN32
+	syncMapping(tmp.data, tmp.size, tmp.file);
+#else
+	syncMapping(tmp.data, tmp.size, nullptr);
+#endif
+	unmapFile(tmp);
+
+	unmapFile(map);
+	bool replaced = replaceFile(tmpPath, path);
+	if (!mapFile(path, 0, map)) {
+		index.clear();
+		end = liveBytes = 0;
+		return false;
+	}
+	if (!replaced) {
+		return false;
+	}
+	index.swap(newIndex);
+	liveBytes = newLive;
+	end = at;
+	return true;
+}
+
+bool KVStore::get(const std::string& key, Value& out)
+{
+	auto it = index.find(key);
+	if (it == index.end()) {
+		return false;
+	}
+	auto rec = (const KVRecord*)(map.data + it->second);
+	if (isExpired(rec, nowMs())) {
+		liveBytes -= recordSize(rec->keyLen, rec->valueLen);
+		index.erase(it);
+		return false;
+	}
+	out = {
+		.data = map.data + it->second + sizeof(KVRecord) + rec->keyLen,
+		.len = rec->valueLen,
+		.binary = (rec->flags & KV_FLAG_BINARY) != 0,
+	};
+	return true;
+}
+
+bool KVStore::set(const std::string& key, const void *data, size_t len, bool binary, int64_t expiresAtMs)
+{
+	size_t size = recordSize(key.size(), len);
+	if (!map.data || (size > map.size - end && !compact(size))) {
+		return false;
+	}
+	size_t at = end;
+	if (!append(map, end, key, data, len, binary ? KV_FLAG_BINARY : 0, expiresAtMs)) {
+		return false;
+	}
+	auto it = index.find(key);
+	if (it != index.end()) {
+		auto old = (const KVRecord*)(map.data + it->second);
+		liveBytes -= recordSize(old->keyLen, old->valueLen);
+		it->second = at;
+	} else {
+		index.emplace(key, at);
+	}
+	liveBytes += size;
+	return true;
+}
+
+bool KVStore::remove(const std::string& key)
+{
+	auto it = index.find(key);
+	if (it == index.end()) {
+		return false;
+	}
+	size_t size = recordSize(key.size(), 0);
+	if (size > map.size - end && !compact(size)) {
+		return false;
+	}
+	// Compaction moves records and drops expired ones, look the key up again
+	it = index.find(key);
+	if (it == index.end()) {
+		return false; // Expired, so already gone from the file
+	}
+	auto old = (const KVRecord*)(map.data + it->second);
+	liveBytes -= recordSize(old->keyLen, old->valueLen);
+	index.erase(it);
+	append(map, end, key, nullptr, 0, KV_FLAG_DELETED, 0);
+	return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Persistent key-value store in a memory-mapped, append-only file
+//
+// Records are checksummed and their magic is written last, so a record torn by a crash is
+// ignored on the next open along with everything after it. Not thread-safe.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class KVStore {
+public:
+	struct Value {
+		const char *data; // Points into the mapping, valid until the next write
+		size_t len;
+		bool binary;
+	};
+
+	~KVStore();
+
+	bool open(const std::string& path, size_t initialSize);
+	void close();
+
+	// Expired keys are dropped on access
+	bool get(const std::string& key, Value& out);
+
+	// `expiresAtMs` of 0 never expires
+	bool set(const std::string& key, const void *data, size_t len, bool binary, int64_t expiresAtMs);
+	bool remove(const std::string& key);
+
+	size_t size() const {
+		return index.size();
+	}
+
+private:
+	struct Mapping {
+		char *data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		void *file = nullptr, *mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+	};
+
+	std::string path;
+	Mapping map;
+	std::unordered_map<std::string, size_t> index; // Key to record offset
+	size_t end = 0; // Where the next record goes
+	size_t liveBytes = 0; // Bytes of records in the index
+
+	static bool mapFile(const std::string& path, size_t minSize, Mapping& out);
+	static void unmapFile(Mapping& map);
+
+	bool append(Mapping& target, size_t& at, const std::string& key, const void *data, size_t len,
+			uint32_t flags, int64_t expiresAtMs);
+	bool compact(size_t extra);
+	void load();
+};
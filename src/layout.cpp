@@ -0,0 +1,207 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Which shown items are followed by a separator, in one pass from the end
+static std::vector<bool> separatorFlags(const std::vector<LayoutItem>& items, const std::vector<LayoutSpan>& spans)
+{
+	std::vector<bool> flags(items.size());
+	bool followed[3] = {};
+	for (size_t i = items.size(); i-- > 0;) {
+		if (!spans[i].shown) {
+			continue;
+		}
+		int group = (int)items[i].group;
+		flags[i] = items[i].separator && followed[group];
+		followed[group] = true;
+	}
+	return flags;
+}
+
+static int groupWidth(const std::vector<LayoutItem>& items, const std::vector<LayoutSpan>& spans,
+		const std::vector<bool>& separators, LayoutGroup group, int separatorWidth)
+{
+	int width = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (spans[i].shown && items[i].group == group) {
+			width += spans[i].width + (separators[i] ? separatorWidth : 0);
+		}
+	}
+	return width;
+}
+
+static int totalWidth(const std::vector<LayoutItem>& items, const std::vector<LayoutSpan>& spans, int separatorWidth)
+{
+	std::vector<bool> separators = separatorFlags(items, spans);
+	int width = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (spans[i].shown) {
+			width += spans[i].width + (separators[i] ? separatorWidth : 0);
+		}
+	}
+	return width;
+}
+
+// Hides a shown item, returning how much narrower the layout became
+static int hideItem(const std::vector<LayoutItem>& items, std::vector<LayoutSpan>& spans, size_t i, int separatorWidth)
+{
+	auto sameGroup = [&items, &spans, i](size_t j) {
+		return spans[j].shown && items[j].group == items[i].group;
+	};
+	bool followed = false;
+	for (size_t j = i + 1; j < items.size() && !followed; j++) {
+		followed = sameGroup(j);
+	}
+	int freed = spans[i].width + (items[i].separator && followed ? separatorWidth : 0);
+	spans[i].shown = false;
+
+	// The previous item loses its separator if this was the last one in the group
+	if (!followed) {
+		for (size_t j = i; j-- > 0;) {
+			if (sameGroup(j)) {
+				freed += items[j].separator ? separatorWidth : 0;
+				break;
+			}
+		}
+	}
+	return freed;
+}
+
+static void setContentWidth(const LayoutItem& item, LayoutSpan& span, int width)
+{
+	span.contentWidth = width;
+	span.width = item.padLeft + width + item.padRight;
+}
+
+static int placeGroup(const std::vector<LayoutItem>& items, Layout& out, const std::vector<bool>& separators,
+		LayoutGroup group, int x, int separatorWidth)
+{
+	for (size_t i = 0; i < items.size(); i++) {
+		LayoutSpan& span = out.spans[i];
+		if (!span.shown || items[i].group != group) {
+			continue;
+		}
+		span.x = x;
+		span.contentX = x + items[i].padLeft;
+		x += span.width;
+		if (separators[i]) {
+			out.separators.push_back({ .x = x + separatorWidth / 2, .item = i });
+			x += separatorWidth;
+		}
+	}
+	return x;
+}
+
+void computeLayout(const std::vector<LayoutItem>& items, int barWidth, int separatorWidth, Layout& out)
+{
+	out.spans.assign(items.size(), {});
+	out.separators.clear();
+
+	// Natural widths, clamped to the block limits
+	for (size_t i = 0; i < items.size(); i++) {
+		const LayoutItem& item = items[i];
+		LayoutSpan& span = out.spans[i];
+		span.shown = item.visible;
+		int width = item.width;
+		if (item.maxWidth > 0 && width > item.maxWidth) {
+			width = item.maxWidth;
+			span.ellipsized = true;
+		}
+		setContentWidth(item, span, std::max(width, item.minWidth));
+	}
+
+	// Resolve overflow, lowest priority first and later blocks before earlier ones
+	int excess = totalWidth(items, out.spans, separatorWidth) - barWidth;
+	if (excess > 0) {
+		std::vector<size_t> order(items.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&items](size_t a, size_t b) {
+			return items[a].priority != items[b].priority ? items[a].priority < items[b].priority : a > b;
+		});
+
+		// Shrink what can be ellipsized and hide the rest
+		for (size_t i : order) {
+			if (excess <= 0) {
+				break;
+			}
+			const LayoutItem& item = items[i];
+			LayoutSpan& span = out.spans[i];
+			if (!span.shown) {
+				continue;
+			}
+			if (item.overflow == LayoutOverflow::Ellipsize) {
+				int cut = std::min(excess, std::max(span.contentWidth - std::max(item.minWidth, 0), 0));
+				if (cut > 0) {
+					setContentWidth(item, span, span.contentWidth - cut);
+					span.ellipsized = true;
+					excess -= cut;
+				}
+			} else {
+				excess -= hideItem(items, out.spans, i, separatorWidth);
+			}
+		}
+
+		// Ellipsized blocks at their minimum still didn't fit
+		for (size_t i : order) {
+			if (excess <= 0) {
+				break;
+			}
+			if (out.spans[i].shown) {
+				excess -= hideItem(items, out.spans, i, separatorWidth);
+			}
+		}
+	}
+
+	// Place groups: left from the start, right against the end, center in between
+	std::vector<bool> separators = separatorFlags(items, out.spans);
+	int leftEnd = placeGroup(items, out, separators, LayoutGroup::Left, 0, separatorWidth);
+	int rightStart = barWidth - groupWidth(items, out.spans, separators, LayoutGroup::Right, separatorWidth);
+	placeGroup(items, out, separators, LayoutGroup::Right, rightStart, separatorWidth);
+	int centerWidth = groupWidth(items, out.spans, separators, LayoutGroup::Center, separatorWidth);
+	int centerX = std::max(leftEnd, std::min((barWidth - centerWidth) / 2, rightStart - centerWidth));
+	placeGroup(items, out, separators, LayoutGroup::Center, centerX, separatorWidth);
+
+	// Hidden blocks keep a zero-size span
+	for (LayoutSpan& span : out.spans) {
+		if (!span.shown) {
+			span = {};
+		}
+	}
+}
+
+bool LayoutEngine::update(const std::vector<LayoutItem>& items, int barWidth)
+{
+	if (barWidth == lastBarWidth && items == lastItems) {
+		return false;
+	}
+	computeLayout(items, barWidth, separatorWidth, layout);
+	lastItems = items;
+	lastBarWidth = barWidth;
+	return true;
+}
+
+void HitIndex::build(const Layout& layout)
+{
+	entries.clear();
+	for (size_t i = 0; i < layout.spans.size(); i++) {
+		const LayoutSpan& span = layout.spans[i];
+		if (span.shown && span.width > 0) {
+			entries.push_back({ .x0 = span.x, .x1 = span.x + span.width, .item = i });
+		}
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.x0 < b.x0;
+	});
+}
+
+int HitIndex::find(int x) const
+{
+	auto it = std::upper_bound(entries.begin(), entries.end(), x, [](int x, const Entry& entry) {
+		return x < entry.x0;
+	});
+	if (it == entries.begin() || x >= (--it)->x1) {
+		return -1;
+	}
+	return it->item;
+}
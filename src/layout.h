@@ -0,0 +1,78 @@
+#pragma once
+
+// Portable block layout, no Windows dependencies
+
+#include <cstddef>
+#include <vector>
+
+enum class LayoutGroup { Left, Center, Right };
+enum class LayoutOverflow { Hide, Ellipsize };
+
+// Layout input for a single block
+struct LayoutItem {
+	bool visible = true;
+	int width = 0; // Measured content width, without padding
+	int padLeft = 0, padRight = 0;
+	int minWidth = 0, maxWidth = 0; // Content width limits, 0 for no maximum
+	int priority = 0; // Lowest priority is ellipsized or hidden first on overflow
+	LayoutGroup group = LayoutGroup::Right;
+	LayoutOverflow overflow = LayoutOverflow::Hide;
+	bool separator = false; // Separator after this item if another follows in the same group
+
+	bool operator==(const LayoutItem&) const = default;
+};
+
+// Layout output for a single block
+struct LayoutSpan {
+	int x = 0, width = 0; // Including padding
+	int contentX = 0, contentWidth = 0;
+	bool shown = false;
+	bool ellipsized = false;
+
+	bool operator==(const LayoutSpan&) const = default;
+};
+
+struct LayoutSeparator {
+	int x;
+	size_t item; // Item the separator follows
+};
+
+struct Layout {
+	std::vector<LayoutSpan> spans; // One per item
+	std::vector<LayoutSeparator> separators;
+};
+
+void computeLayout(const std::vector<LayoutItem>& items, int barWidth, int separatorWidth, Layout& out);
+
+// Caches the last layout, recomputing only when an input changes
+class LayoutEngine {
+	std::vector<LayoutItem> lastItems;
+	int lastBarWidth = -1;
+	int separatorWidth;
+	Layout layout;
+
+public:
+	LayoutEngine(int separatorWidth = 9) : separatorWidth(separatorWidth) {};
+
+	// Returns true if the layout was recomputed
+	bool update(const std::vector<LayoutItem>& items, int barWidth);
+
+	const Layout& get() const {
+		return layout;
+	}
+};
+
+// Maps bar x coordinates back to items using the spans of a layout
+class HitIndex {
+	struct Entry {
+		int x0, x1;
+		size_t item;
+	};
+	std::vector<Entry> entries; // Sorted and non-overlapping
+
+public:
+	void build(const Layout& layout);
+
+	// Returns the item at x, or -1
+	int find(int x) const;
+};
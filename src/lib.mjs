@@ -1,5 +1,26 @@
 import * as std from 'std';
-import * as os from 'os';
+import * as nativeOs from 'os';
+
+// Runs `fn` attributed to a script, see scripts.h. Does nothing once the script is disabled. Promise jobs
+// it queued run before leaving, so code after an `await` in an async callback is charged to the script too.
+const inScript = (script, fn) => (...args) => {
+	if (__wbc.scriptDisabled(script)) {
+		return;
+	}
+	const prev = __wbc.enterScript(script);
+	try {
+		return fn(...args);
+	} finally {
+		__wbc.runPendingJobs();
+		__wbc.enterScript(prev);
+	}
+};
+
+// Timers belong to the script that created them, and slow down while the bar can't be seen
+const os = {
+	...nativeOs,
+	setTimeout: (fn, delay) => nativeOs.setTimeout(inScript(__wbc.currentScript(), fn), delay * __wbc.timerStretch()),
+};
 globalThis.std = std;
 globalThis.os = os;
 
@@ -40,34 +61,117 @@ globalThis.$quote = arg => {
 	return str + '"';
 };
 
-globalThis.$ps = async cmd => await $(`powershell -Command ${globalThis.$quote(cmd)}`);
+const psCommand = cmd => `powershell -Command ${globalThis.$quote(cmd)}`;
+const psFetchCommand = url =>
+	psCommand(`$ProgressPreference='SilentlyContinue';$(Invoke-WebRequest '${url.replace(/'/g, "''")}').Content`);
 
-globalThis.$psFetch = async url => {
-	const cmd = `$ProgressPreference='SilentlyContinue';$(Invoke-WebRequest '${url.replace(/'/g, "''")}').Content`;
-	return await globalThis.$ps(cmd);
-};
+globalThis.$ps = async (cmd, options) => await $(psCommand(cmd), options);
+
+globalThis.$psFetch = async (url, options) => await $(psFetchCommand(url), options);
+
+// Parsed off the JS thread, see `$json`
+globalThis.fetchJson = async (url, path, options) => await $json(psFetchCommand(url), path, options);
 
-// TODO: colored info, warn, error
-console.error = (...args) => std.err.printf('%s\n', args.join(' '));;
+// Just enough of AbortController for the `signal` option of `$` and friends
+class AbortSignal {
+	aborted = false;
+	reason = undefined;
+	onabort = null;
+	listeners = [];
 
-// Load all scripts within the `blocks` dir
+	addEventListener(type, fn) {
+		if (type === 'abort') {
+			this.listeners.push(fn);
+		}
+	}
+
+	removeEventListener(type, fn) {
+		this.listeners = this.listeners.filter(l => l !== fn);
+	}
+
+	throwIfAborted() {
+		if (this.aborted) {
+			throw this.reason;
+		}
+	}
+
+	static timeout(ms) {
+		const controller = new AbortController();
+		os.setTimeout(() => controller.abort(new Error('signal timed out')), ms);
+		return controller.signal;
+	}
+}
+
+class AbortController {
+	signal = new AbortSignal();
+
+	abort(reason = new Error('aborted')) {
+		const signal = this.signal;
+		if (signal.aborted) {
+			return;
+		}
+		signal.aborted = true;
+		signal.reason = reason;
+		for (const fn of [signal.onabort, ...signal.listeners]) {
+			try {
+				fn?.call(signal, { type: 'abort', target: signal });
+			} catch (ex) {
+				console.error('Error in abort listener:', ex);
+			}
+		}
+	}
+}
+
+globalThis.AbortSignal ??= AbortSignal;
+globalThis.AbortController ??= AbortController;
+
+// Levels match `LogLevel` in log.h
+const logFn = level => (...args) => __wbc.log(level, args.join(' '));
+console.log = console.info = logFn(0);
+console.warn = logFn(1);
+console.error = logFn(2);
+
+// Load all scripts and `.block` files within the `blocks` dir, read in parallel off the JS thread but ran in order
 const [files, err] = os.readdir('./blocks');
 if (err) {
 	console.error('Failed to open directory "blocks", does it exist?');
 	std.exit(1);
 }
-files.filter(f => !f.startsWith('.')).sort().forEach(script => {
-	std.out.printf('Loading %s... ', script);
-	const data = std.loadFile('./blocks/' + script);
-	if (!data) {
-		throw 'Failed to load ' + data;
-	}
-	try {
-		(() => {
+const scripts = files.filter(f => !f.startsWith('.')).sort();
+const sources = scripts.map(script => readFile('./blocks/' + script));
+(async () => {
+	for (let i = 0; i < scripts.length; i++) {
+		const script = scripts[i];
+		let data;
+		try {
+			data = await sources[i];
+		} catch (ex) {
+			console.error(`Failed to load script '${script}':`, ex);
+			continue;
+		}
+
+		// Definitions for native blocks, see nativeblock.h
+		if (script.endsWith('.block')) {
+			try {
+				__wbc.loadNativeBlock(data);
+				console.info(`Loaded block '${script}'`);
+			} catch (ex) {
+				console.error(`Error in block '${script}':`, ex);
+			}
+			continue;
+		}
+
+		// Isolated so a script interrupted for running too long doesn't stop the others from loading
+		const prevScript = __wbc.enterScript(__wbc.registerScript(script));
+		const ex = __wbc.isolate(() => {
 			eval(data);
-		})();
-		std.out.printf('OK!\n');
-	} catch (ex) {
-		console.error(`Error running script '${script}':`, ex);
+			__wbc.runPendingJobs();
+		});
+		__wbc.enterScript(prevScript);
+		if (ex === undefined) {
+			console.info(`Loaded script '${script}'`);
+		} else {
+			console.error(`Error running script '${script}':`, ex);
+		}
 	}
-});
\ No newline at end of file
+})();
@@ -0,0 +1,266 @@
+#include "log.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define pipe(fds) _pipe(fds, 4096, _O_BINARY)
+#define dup2 _dup2
+#define read _read
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+#define LOG_RING_SLOTS 1024 // Must be a power of two
+#define LOG_SLOT_TEXT 480
+#define LOG_FLUSH_INTERVAL_MS 50
+
+struct LogSlot {
+	std::atomic<size_t> seq;
+	int64_t timeMs;
+	LogLevel level;
+	uint16_t len;
+	char text[LOG_SLOT_TEXT];
+};
+
+static LogSlot ring[LOG_RING_SLOTS];
+static std::atomic<size_t> enqueuePos;
+static size_t dequeuePos;
+
+static struct {
+	std::string path;
+	size_t maxBytes;
+	int keepFiles;
+	bool echo;
+
+	FILE *file;
+	size_t size;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running;
+} logger;
+
+static const char *levelNames[] = { "INFO", "WARN", "ERROR" };
+
+static void openLogFile()
+{
+	logger.file = fopen(logger.path.c_str(), "ab");
+	logger.size = 0;
+	if (logger.file) {
+		fseek(logger.file, 0, SEEK_END);
+		logger.size = ftell(logger.file);
+	}
+}
+
+// Shifts `path.N-1` to `path.N` and so on, ending with `path` to `path.1`
+static void rotateLogFile()
+{
+	fclose(logger.file);
+	for (int i = logger.keepFiles; i > 0; i--) {
+		std::string to = logger.path + "." + std::to_string(i);
+		std::string from = i > 1 ? logger.path + "." + std::to_string(i - 1) : logger.path;
+		remove(to.c_str());
+		rename(from.c_str(), to.c_str());
+	}
+	if (logger.keepFiles <= 0) {
+		remove(logger.path.c_str());
+	}
+	openLogFile();
+}
+
+static void formatSlot(std::string& out, const LogSlot& slot)
+{
+	time_t secs = slot.timeMs / 1000;
+	struct tm tm;
+#ifdef _WIN32
+	localtime_s(&tm, &secs);
+#else
+	localtime_r(&secs, &tm);
+#endif
+	char prefix[64];
+	size_t n = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(prefix + n, sizeof(prefix) - n, ".%03d [%s] ", (int)(slot.timeMs % 1000), levelNames[(int)slot.level]);
+	out += prefix;
+	out.append(slot.text, slot.len);
+	out += '\n';
+}
+
+// Moves everything queued into one write, ran on the flusher thread
+static void drainRing()
+{
+	std::string batch;
+	while (true) {
+		LogSlot& slot = ring[dequeuePos & (LOG_RING_SLOTS - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != dequeuePos + 1) {
+			break;
+		}
+		formatSlot(batch, slot);
+		slot.seq.store(dequeuePos + LOG_RING_SLOTS, std::memory_order_release);
+		dequeuePos++;
+	}
+	if (batch.empty()) {
+		return;
+	}
+	if (logger.echo) {
+		fwrite(batch.data(), 1, batch.size(), stdout);
+	}
+	if (logger.file) {
+		fwrite(batch.data(), 1, batch.size(), logger.file);
+		fflush(logger.file);
+		logger.size += batch.size();
+		if (logger.size > logger.maxBytes) {
+			rotateLogFile();
+		}
+	}
+}
+
+static void flusherThreadFn()
+{
+	std::unique_lock<std::mutex> lock(logger.mutex);
+	while (logger.running) {
+		logger.wake.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+		drainRing();
+	}
+	drainRing();
+}
+
+bool logInit(const char *path, size_t maxBytes, int keepFiles, bool echo)
+{
+	for (size_t i = 0; i < LOG_RING_SLOTS; i++) {
+		ring[i].seq.store(i, std::memory_order_relaxed);
+	}
+	logger.path = path;
+	logger.maxBytes = maxBytes;
+	logger.keepFiles = keepFiles;
+	logger.echo = echo;
+	openLogFile();
+	logger.running = true;
+	logger.thread = std::thread(flusherThreadFn);
+	atexit(logShutdown);
+	return logger.file != nullptr;
+}
+
+void logShutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(logger.mutex);
+		if (!logger.running) {
+			return;
+		}
+		logger.running = false;
+	}
+	logger.wake.notify_one();
+	logger.thread.join();
+	if (logger.file) {
+		fclose(logger.file);
+		logger.file = nullptr;
+	}
+}
+
+void logWrite(LogLevel level, const char *source, const char *msg, size_t len)
+{
+	// Claim a slot (bounded MPMC queue, only ever drained by the flusher)
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	LogSlot *slot;
+	while (true) {
+		slot = &ring[pos & (LOG_RING_SLOTS - 1)];
+		intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			stats.logDropped.add();
+			return;
+		} else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	slot->level = level;
+	int n = snprintf(slot->text, LOG_SLOT_TEXT, "%s: ", source);
+	n = std::min(n, LOG_SLOT_TEXT - 1);
+	size_t copy = std::min(len, (size_t)(LOG_SLOT_TEXT - n));
+	memcpy(slot->text + n, msg, copy);
+	slot->len = n + copy;
+	slot->seq.store(pos + 1, std::memory_order_release);
+
+	if (level == LogLevel::Error) {
+		logger.wake.notify_one();
+	}
+}
+
+void logPrintf(LogLevel level, const char *source, const char *fmt, ...)
+{
+	char buf[LOG_SLOT_TEXT];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n >= 0) {
+		logWrite(level, source, buf, std::min((size_t)n, sizeof(buf) - 1));
+	}
+}
+
+static void stdioThreadFn(int fd)
+{
+	std::string line;
+	char buf[1024];
+	int n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (int i = 0; i < n; i++) {
+			if (buf[i] == '\n') {
+				if (!line.empty() && line.back() == '\r') {
+					line.pop_back();
+				}
+				logWrite(LogLevel::Info, "stdio", line.data(), line.size());
+				line.clear();
+			} else {
+				line += buf[i];
+			}
+		}
+	}
+}
+
+bool logCaptureStdio()
+{
+	int fds[2];
+	if (pipe(fds)) {
+		return false;
+	}
+	if (dup2(fds[1], fileno(stdout)) < 0 || dup2(fds[1], fileno(stderr)) < 0) {
+		return false;
+	}
+	std::thread(stdioThreadFn, fds[0]).detach();
+	return true;
+}
+
+bool LogRateLimiter::allow(const std::string& source, uint64_t nowUs, uint64_t *suppressed)
+{
+	auto [it, created] = buckets.try_emplace(source, Bucket{ .tokens = burst, .lastUs = nowUs, .suppressed = 0 });
+	Bucket& bucket = it->second;
+	bucket.tokens = std::min(burst, bucket.tokens + (nowUs - bucket.lastUs) / 1e6 * perSecond);
+	bucket.lastUs = nowUs;
+	if (bucket.tokens < 1) {
+		bucket.suppressed++;
+		return false;
+	}
+	bucket.tokens -= 1;
+	*suppressed = bucket.suppressed;
+	bucket.suppressed = 0;
+	return true;
+}
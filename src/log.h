@@ -0,0 +1,40 @@
+#pragma once
+
+// Asynchronous logger: callers push into a lock-free ring, a background thread writes it out
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+enum class LogLevel { Info, Warn, Error };
+
+// Starts the flusher thread, appending to `path` and rotating it to `path.1`...`path.N` past `maxBytes`
+bool logInit(const char *path, size_t maxBytes, int keepFiles, bool echo);
+
+// Flushes everything queued so far and stops the flusher thread
+void logShutdown();
+
+// Never blocks, lines are dropped if the ring is full
+void logWrite(LogLevel level, const char *source, const char *msg, size_t len);
+void logPrintf(LogLevel level, const char *source, const char *fmt, ...);
+
+// Redirects stdout and stderr into the log as info lines
+bool logCaptureStdio();
+
+// Per-source token bucket, not thread-safe
+class LogRateLimiter {
+	struct Bucket {
+		double tokens;
+		uint64_t lastUs;
+		uint64_t suppressed;
+	};
+	std::unordered_map<std::string, Bucket> buckets;
+	double perSecond, burst;
+
+public:
+	LogRateLimiter(double perSecond, double burst) : perSecond(perSecond), burst(burst) {};
+
+	// Returns false if the line should be dropped, `suppressed` gets the count dropped before an allowed line
+	bool allow(const std::string& source, uint64_t nowUs, uint64_t *suppressed);
+};
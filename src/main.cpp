@@ -1,12 +1,10 @@
-// TODO:
-// - click handlers for blocks
-
 // Require Windows 10
 #define WINVER 0x0A00
 #define _WIN32_WINNT 0x0A00
 
 extern "C" {
 #include <windows.h>
+#include <wincodec.h>
 #include <assert.h>
 #include <io.h>
 
@@ -19,6 +17,26 @@ extern "C" {
 INCTXT(wblocksLibMJS, "src/lib.mjs");
 }
 
+#include "animation.h"
+#include "barplan.h"
+#include "fileio.h"
+#include "graph.h"
+#include "imagecache.h"
+#include "ipc.h"
+#include "jsbind.h"
+#include "json.h"
+#include "jsmem.h"
+#include "kvstore.h"
+#include "layout.h"
+#include "log.h"
+#include "nativeblock.h"
+#include "power.h"
+#include "process.h"
+#include "scripts.h"
+#include "stats.h"
+#include "trace.h"
+#include "workerpool.h"
+
 #include <vector>
 #include <memory>
 #include <algorithm>
@@ -26,6 +44,12 @@ INCTXT(wblocksLibMJS, "src/lib.mjs");
 #include <thread>
 #include <mutex>
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <bit>
+#include <cmath>
+#include <limits>
 
 #define WBLOCKS_BAR_CLASS "wblocks2_bar"
 #define WM_WBLOCKS_TRAY (WM_USER + 1)
@@ -33,15 +57,49 @@ INCTXT(wblocksLibMJS, "src/lib.mjs");
 #define TRAY_MENU_SHOW_LOG 1
 #define TRAY_MENU_RESTART 2
 #define TRAY_MENU_EXIT 3
+#define TRAY_MENU_SHOW_STATS 4
+#define TRAY_MENU_TRACE 5
 
 #define WBLOCKS_MAX_LEN 1024
+#define WBLOCKS_MAX_PUSHED_BLOCKS 64 // Made by IPC pushes to names no block had
+#define WBLOCKS_BAR_SCAN_MS 2000 // Looking for taskbars on monitors plugged in since
+#define WBLOCKS_VISIBILITY_POLL_MS 100
+#define WBLOCKS_TIMER_STRETCH 4 // While hidden, scripts can change it with `setTimerStretch`
+#define WBLOCKS_LOOP_MS 10
+#define WBLOCKS_HIDDEN_LOOP_MS 50
+#define WBLOCKS_ANIMATION_FPS 30 // Shared by every animated block
+#define WBLOCKS_SEPARATOR_WIDTH 9
+#define WBLOCKS_VISUAL_GAP 4 // Between an image, a graph and the block text
+#define WBLOCKS_MAX_SEGMENTS 256 // Per block
+#define WBLOCKS_IMAGE_CACHE_BYTES (16 * 1024 * 1024) // Decoded images kept around while unused
+#define WBLOCKS_IMAGE_MAX_HEIGHT 1024 // Scripts can ask images to be scaled to
+#define WBLOCKS_IMAGE_MAX_SIDE 4096 // Of a decoded image, larger ones fail to load
 
 #define WBLOCKS_LOGFILE "wblocks.log"
+#define WBLOCKS_LOG_MAX_BYTES (1024 * 1024)
+#define WBLOCKS_LOG_KEEP 3
+#define WBLOCKS_LOG_RATE 20 // Lines per second per source from scripts
+#define WBLOCKS_LOG_BURST 100
+
+#define WBLOCKS_JS_MEMORY_LIMIT (256 * 1024 * 1024) // Default, scripts can change it with `setMemoryLimit`
+#define WBLOCKS_JS_MEMORY_SAMPLE_US (10 * 1000 * 1000)
+
+#define WBLOCKS_IO_THREADS 4 // Enough that one slow share doesn't hold up every read
+#define WBLOCKS_TAIL_MAX_BYTES (1024 * 1024)
+#define WBLOCKS_NATIVE_BLOCK_THREADS 4 // Running `.block` commands
+
+#define WBLOCKS_KVFILE "wblocks.kv"
+#define WBLOCKS_KV_INITIAL_SIZE (1024 * 1024)
+#define WBLOCKS_KV_OPEN_RETRIES 5 // Backing off from 50 ms, while a restarting instance lets go of the file
+#define WBLOCKS_KV_MAX_TTL (100.0 * 365 * 24 * 3600)
+#define WBLOCKS_STATSFILE "wblocks-stats.txt"
+#define WBLOCKS_TRACEFILE "wblocks.trace"
 
 #define QJS_SET_PROP_FN(ctx, obj, name, fn, len) \
 	JS_SetPropertyStr(ctx, obj, name, JS_NewCFunction(ctx, fn, name, len))
 
 JSClassID jsBlockClassId;
+JSClassID jsImageClassId;
 UINT_PTR createWindowTimer;
 HINSTANCE hInst;
 
@@ -50,142 +108,835 @@ std::mutex jsThreadQueueMutex;
 
 struct FontRef {
 	HFONT handle;
-	FontRef(HFONT handle) : handle(handle) {};
+	std::string name;
+	int size;
+	FontRef(HFONT handle, const std::string& name, int size) : handle(handle), name(name), size(size) {};
 	~FontRef() {
 		DeleteObject(handle);
 	}
 };
 
+// Fonts in use, shared between blocks and segments with the same name and size. JS thread only.
+std::map<std::pair<std::string, int>, std::weak_ptr<FontRef>> fontCache;
+
+std::shared_ptr<FontRef> getFont(const std::string& name, int size)
+{
+	auto& cached = fontCache[{name, size}];
+	std::shared_ptr<FontRef> font = cached.lock();
+	if (!font) {
+		HFONT handle = CreateFont(size, 0, 0, 0, FW_NORMAL, 0, 0, 0, 0, 0, 0, 0, 0, name.c_str());
+		if (!handle) {
+			fontCache.erase({name, size});
+			return nullptr;
+		}
+		font = std::make_shared<FontRef>(handle, name, size);
+		cached = font;
+	}
+	return font;
+}
+
+std::wstring toWide(const std::string& str)
+{
+	std::wstring wide;
+	int required = MultiByteToWideChar(CP_UTF8, MB_PRECOMPOSED, str.c_str(), str.length(), nullptr, 0);
+	assert(required >= 0);
+	wide.resize(required);
+	assert(MultiByteToWideChar(CP_UTF8, MB_PRECOMPOSED, str.c_str(), str.length(), wide.data(), required) == required);
+	return wide;
+}
+
+std::string fromWide(const std::wstring& wide)
+{
+	std::string str;
+	int required = WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), wide.length(), NULL, 0, NULL, NULL);
+	str.resize(required);
+	WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), wide.length(), str.data(), required, NULL, NULL);
+	return str;
+}
+
+// Differently styled run of text within a block
+struct TextSegment {
+	std::wstring text;
+	std::optional<COLORREF> color; // Block color if unset
+	std::shared_ptr<FontRef> font; // Block font if null
+	int width = -1; // Cached until the text or font changes
+};
+
 struct Block {
 private:
 	std::wstring text;
+	std::vector<TextSegment> segments; // Drawn instead of `text` if not empty
 	std::shared_ptr<FontRef> font;
+	int measuredWidth = -1; // Text width in pixels, -1 when it needs measuring
+
+	HFONT fontFor(const TextSegment& seg) const {
+		return seg.font ? seg.font->handle : font ? font->handle : NULL;
+	}
 
 public:
 	bool visible = true;
 	COLORREF color = RGB(255, 255, 255);
 	size_t padLeft = 5, padRight = 5;
+	int minWidth = 0, maxWidth = 0;
+	int priority = 0;
+	LayoutGroup group = LayoutGroup::Right;
+	LayoutOverflow overflow = LayoutOverflow::Hide;
+	bool separator = false;
+	bool interactive = false; // Has input handlers, set from the JS thread
+	std::shared_ptr<Image> image; // Shared with the image cache and other blocks
+	std::shared_ptr<Graph> graph;
+	int graphHeight = 0; // 0 for 60% of the bar
+	uint32_t traceId = 0; // 0 for defaultBlock
+	BarMask bars = barMaskAll; // Taskbars shown on
+	Animation animation;
+	uint64_t animationStartUs = 0;
+	AnimationFrame frame; // As last drawn, advanced on the UI thread
+	mutable bool dirty = true; // Changed since last drawn, set with every traced change
+
+	bool hasText() const {
+		return !text.empty() || !segments.empty();
+	}
+
+	// Width of what is drawn before the text
+	int visualWidth() const {
+		int width = 0;
+		if (image) {
+			width += image->width + WBLOCKS_VISUAL_GAP;
+		}
+		if (graph) {
+			width += graph->columns() + WBLOCKS_VISUAL_GAP;
+		}
+		return width && !hasText() ? width - WBLOCKS_VISUAL_GAP : width;
+	}
 
 	void setText(const std::string txt) {
-		int required = MultiByteToWideChar(CP_UTF8, MB_PRECOMPOSED, txt.c_str(), txt.length(), nullptr, 0);
-		assert(required >= 0);
-		text.resize(required);
-		assert(MultiByteToWideChar(CP_UTF8, MB_PRECOMPOSED, txt.c_str(), txt.length(), text.data(), required) == required);
+		std::wstring wide = toWide(txt);
+		if (animation.kind == AnimationKind::Marquee && wide != text) {
+			animationStartUs = nowUs(); // New titles scroll in from their start
+		}
+		text = std::move(wide);
+		segments.clear();
+		measuredWidth = -1;
+	}
+
+	// Keeps the measured width of segments that didn't change
+	void setSegments(std::vector<TextSegment> newSegments) {
+		for (size_t i = 0; i < std::min(segments.size(), newSegments.size()); i++) {
+			if (newSegments[i].text == segments[i].text && newSegments[i].font == segments[i].font) {
+				newSegments[i].width = segments[i].width;
+			}
+		}
+		segments = std::move(newSegments);
+		text.clear();
+		measuredWidth = -1;
 	}
 
 	// Returns true on success
 	bool setFont(const std::string& fontName, int fontSize) {
-		HFONT handle = CreateFont(fontSize, 0, 0, 0, FW_NORMAL, 0, 0, 0, 0, 0, 0, 0, 0, fontName.c_str());
-		if (!handle) {
+		auto newFont = ::getFont(fontName, fontSize);
+		if (!newFont) {
+			return false;
+		}
+		font = newFont;
+		for (TextSegment& seg : segments) {
+			if (!seg.font) {
+				seg.width = -1;
+			}
+		}
+		measuredWidth = -1;
+		return true;
+	}
+
+	const std::shared_ptr<FontRef>& blockFont() const {
+		return font;
+	}
+
+	void setAnimation(const Animation& newAnimation) {
+		animation = newAnimation;
+		animationStartUs = nowUs();
+		frame = {};
+	}
+
+	// Moves the animation on to `frameUs`, returning true if it looks different. Needs a layout first
+	// for the text width.
+	bool animate(uint64_t frameUs) {
+		if (animation.kind == AnimationKind::None) {
+			return false;
+		}
+		AnimationFrame next = animationFrame(animation, frameUs - std::min(frameUs, animationStartUs), measuredWidth);
+		if (next == frame) {
 			return false;
 		}
-		font = std::make_shared<FontRef>(handle);;
+		frame = next;
 		return true;
 	}
 
-	void drawBlock(HDC hdc, RECT *rect) const {
-		if (visible) {
+	// Whether the animation shows in `span`, marquees only scrolling text that doesn't fit
+	bool animatesIn(const LayoutSpan& span) const {
+		return animation.kind == AnimationKind::Marquee ? span.ellipsized : animation.kind != AnimationKind::None;
+	}
+
+	// Records the part of the block `op` covers, see trace.h. Every change goes through here, so it also marks
+	// the block for redrawing.
+	void traceState(TraceOp op) const {
+		dirty = true;
+		if (!traceActive.load(std::memory_order_relaxed)) {
+			return;
+		}
+		switch (op) {
+		case TraceOp::Text:
+			trace(op, traceId, {}, fromWide(text));
+			break;
+		case TraceOp::Segments: {
+			std::wstring joined;
+			for (const TextSegment& seg : segments) {
+				joined += seg.text;
+			}
+			trace(op, traceId, {(int64_t)segments.size()}, fromWide(joined));
+			break;
+		}
+		case TraceOp::Font:
+			trace(op, traceId, {font ? font->size : 0}, font ? font->name : "");
+			break;
+		case TraceOp::Color:
+			trace(op, traceId, {color});
+			break;
+		case TraceOp::Padding:
+			trace(op, traceId, {(int64_t)padLeft, (int64_t)padRight});
+			break;
+		case TraceOp::Visible:
+			trace(op, traceId, {visible});
+			break;
+		case TraceOp::Group:
+			trace(op, traceId, {(int)group});
+			break;
+		case TraceOp::Width:
+			trace(op, traceId, {minWidth, maxWidth});
+			break;
+		case TraceOp::Priority:
+			trace(op, traceId, {priority});
+			break;
+		case TraceOp::Overflow:
+			trace(op, traceId, {(int)overflow});
+			break;
+		case TraceOp::Separator:
+			trace(op, traceId, {separator});
+			break;
+		case TraceOp::Interactive:
+			trace(op, traceId, {interactive});
+			break;
+		case TraceOp::Image:
+			trace(op, traceId, {image ? image->width : 0, image ? image->height : 0});
+			break;
+		case TraceOp::Graph:
+			if (graph) {
+				trace(op, traceId, {(int64_t)graph->columns(), graphHeight,
+						std::bit_cast<uint32_t>(graph->minValue()), std::bit_cast<uint32_t>(graph->maxValue())});
+			} else {
+				trace(op, traceId, {0});
+			}
+			break;
+		case TraceOp::Measure:
+			trace(op, traceId, {measuredWidth});
+			break;
+		case TraceOp::Bars:
+			trace(op, traceId, {bars});
+			break;
+		case TraceOp::Animation:
+			trace(op, traceId, {(int)animation.kind, animation.speed, animation.gap, animation.periodMs,
+					animation.minAlpha});
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Records `count` graph samples from ring index `from` on
+	void traceSamples(size_t from, size_t count) const {
+		dirty = true;
+		if (!traceActive.load(std::memory_order_relaxed) || !graph) {
+			return;
+		}
+		std::vector<int64_t> bits(count);
+		for (size_t i = 0; i < count; i++) {
+			bits[i] = std::bit_cast<uint32_t>(graph->samples()[(from + i) % graph->columns()]);
+		}
+		traceWrite(TraceOp::Samples, traceId, bits.data(), count, {});
+	}
+
+	// Records everything, for the start of a trace
+	void traceAll() const {
+		traceState(segments.empty() ? TraceOp::Text : TraceOp::Segments);
+		for (TraceOp op : { TraceOp::Font, TraceOp::Color, TraceOp::Padding, TraceOp::Visible, TraceOp::Group,
+				TraceOp::Width, TraceOp::Priority, TraceOp::Overflow, TraceOp::Separator, TraceOp::Interactive,
+				TraceOp::Image, TraceOp::Graph, TraceOp::Bars, TraceOp::Animation }) {
+			traceState(op);
+		}
+		if (graph) {
+			traceSamples(graph->commit(0), graph->columns());
+		}
+		if (measuredWidth >= 0) {
+			traceState(TraceOp::Measure);
+		}
+	}
+
+	// Measures the text only if it changed since the last layout
+	LayoutItem layoutItem(HDC hdc) {
+		if (measuredWidth < 0) {
+			SIZE ext = {};
+			if (segments.empty()) {
+				if (font) {
+					SelectObject(hdc, font->handle);
+				}
+				GetTextExtentPoint32W(hdc, text.c_str(), text.length(), &ext);
+				measuredWidth = ext.cx;
+			} else {
+				measuredWidth = 0;
+				for (TextSegment& seg : segments) {
+					if (seg.width < 0) {
+						SelectObject(hdc, fontFor(seg));
+						GetTextExtentPoint32W(hdc, seg.text.c_str(), seg.text.length(), &ext);
+						seg.width = ext.cx;
+					}
+					measuredWidth += seg.width;
+				}
+			}
+			traceState(TraceOp::Measure);
+		}
+		return {
+			.visible = visible,
+			.width = visualWidth() + measuredWidth,
+			.padLeft = (int)padLeft,
+			.padRight = (int)padRight,
+			.minWidth = minWidth,
+			.maxWidth = maxWidth,
+			.priority = priority,
+			.group = group,
+			.overflow = overflow,
+			.separator = separator,
+		};
+	}
+
+	// Text from `rect.left`, ellipsized at `rect.right` if `cut`
+	void drawText(HDC hdc, RECT rect, bool cut) const {
+		if (segments.empty()) {
+			SetTextColor(hdc, color);
+			if (font) {
+				SelectObject(hdc, font->handle);
+			}
+			DrawTextW(hdc, text.c_str(), text.length(), &rect,
+					DT_NOPREFIX | DT_SINGLELINE | DT_LEFT | DT_VCENTER | (cut ? DT_END_ELLIPSIS : DT_NOCLIP));
+			return;
+		}
+
+		// One run using the cached widths, the segment crossing the end gets the ellipsis
+		int right = rect.right;
+		for (const TextSegment& seg : segments) {
+			if (rect.left >= right) {
+				break;
+			}
+			rect.right = std::min(rect.left + seg.width, right);
+			bool segCut = rect.left + seg.width > right;
+			SetTextColor(hdc, seg.color.value_or(color));
+			SelectObject(hdc, fontFor(seg));
+			DrawTextW(hdc, seg.text.c_str(), seg.text.length(), &rect,
+					DT_NOPREFIX | DT_SINGLELINE | DT_LEFT | DT_VCENTER | (segCut ? DT_END_ELLIPSIS : DT_NOCLIP));
+			rect.left += seg.width;
+		}
+	}
+
+	void drawBlock(HDC hdc, const LayoutSpan& span, int height) const {
 #ifdef DEBUG
-			wprintf(L"Block, pos: %d, %d, text: %ls (%d)\n", rect->top, rect->right, text.c_str(), text.length());
+		wprintf(L"Block, pos: %d, %d, text: %ls (%d)\n", span.x, span.width, text.c_str(), text.length());
 #endif
-			rect->right -= padRight;
-			SetTextColor(hdc, color),
-			SelectObject(hdc, font->handle);
-			DrawTextW(hdc, text.c_str(), text.length(), rect,
-					DT_NOCLIP | DT_NOPREFIX | DT_SINGLELINE | DT_RIGHT | DT_VCENTER);
-			RECT rectCalc = { .right = rect->right, .bottom = rect->bottom };
-			DrawTextW(hdc, text.c_str(), text.length(), &rectCalc,
-					DT_NOCLIP | DT_NOPREFIX | DT_SINGLELINE | DT_RIGHT | DT_VCENTER | DT_CALCRECT);
-			rect->right -= rectCalc.right + padLeft;
+		RECT rect = { .left = span.contentX + visualWidth(), .top = 0, .right = span.contentX + span.contentWidth, .bottom = height };
+		if (animation.kind != AnimationKind::Marquee || !span.ellipsized) {
+			drawText(hdc, rect, span.ellipsized);
+			return;
 		}
+
+		// Scrolled instead of ellipsized, the next pass following the gap in
+		SaveDC(hdc);
+		IntersectClipRect(hdc, rect.left, rect.top, rect.right, rect.bottom);
+		int left = rect.left - frame.offset;
+		for (int pass = 0; pass < 2 && left < rect.right; pass++, left += measuredWidth + animation.gap) {
+			drawText(hdc, { .left = left, .top = 0, .right = left + measuredWidth, .bottom = height }, false);
+		}
+		RestoreDC(hdc, -1);
+	}
+
+	// Draws what GDI can't into the bar pixels and fades the block, after the GDI drawing is flushed
+	void compositeBlock(uint32_t *pixels, SIZE sz, const LayoutSpan& span) const {
+		int x = span.contentX, right = std::min(span.contentX + span.contentWidth, (int)sz.cx);
+		if (image) {
+			compositeImage(pixels, sz.cx, sz.cy, *image, x, ((int)sz.cy - image->height) / 2, right);
+			x += image->width + WBLOCKS_VISUAL_GAP;
+		}
+		if (graph) {
+			int height = std::min(graphHeight ? graphHeight : (int)sz.cy * 3 / 5, (int)sz.cy);
+			graph->render(height, color);
+			int top = (sz.cy - height) / 2;
+			int width = std::min((int)graph->columns(), right - x);
+			for (int y = 0; y < height && width > 0; y++) {
+				memcpy(pixels + (top + y) * sz.cx + x, graph->pixels() + y * graph->columns(),
+						width * sizeof(uint32_t));
+			}
+		}
+		fadePixels(pixels, sz.cx, std::max(span.x, 0), std::min(span.x + span.width, (int)sz.cx), sz.cy, frame.alpha);
 	}
 };
 
-struct {
+// One per taskbar, the primary first and the others left to right
+struct BarWindow {
 	HWND bar, wnd;
-	HDC screenHDC, hdc;
-	HBITMAP lastBitmap;
-	SIZE lastSize;
 	RECT barRect;
+
+	// Input state, only used on the UI thread
+	Block *hovered;
+	bool trackingMouse;
+};
+
+// Pixels of a planner surface, presented to every bar of the surface
+struct SurfaceRaster {
+	HBITMAP bitmap;
+	uint32_t *pixels; // Premultiplied BGRA of bitmap
+	SIZE size;
+};
+
+struct {
+	HDC screenHDC, hdc;
+	std::vector<BarWindow> bars;
+	std::vector<SurfaceRaster> rasters; // Indexed like the planner surfaces
+	BarPlanner planner{WBLOCKS_SEPARATOR_WIDTH};
+	std::vector<Block*> drawnBlocks; // Blocks as of the last layout, what the surface items index
+	uint64_t lastBarScan;
+	FrameClock frameClock{WBLOCKS_ANIMATION_FPS};
 } wb;
 
+// Hidden once no taskbar can be seen, polled on the UI thread
+class WindowsVisibility : public VisibilitySource {
+	// Foreground window covering its whole monitor, or NULL
+	static HWND fullscreenWindow() {
+		HWND fg = GetForegroundWindow();
+		char cls[32];
+		if (!fg || fg == GetShellWindow() || !GetClassName(fg, cls, sizeof(cls))
+				|| !strcmp(cls, "WorkerW") || !strcmp(cls, "Progman")) {
+			return NULL; // The desktop covers everything without hiding anything
+		}
+		RECT rect;
+		HMONITOR monitor = MonitorFromWindow(fg, MONITOR_DEFAULTTONULL);
+		MONITORINFO info = { .cbSize = sizeof(info) };
+		if (!monitor || !GetWindowRect(fg, &rect) || !GetMonitorInfo(monitor, &info)) {
+			return NULL;
+		}
+		const RECT& m = info.rcMonitor;
+		return rect.left <= m.left && rect.top <= m.top && rect.right >= m.right && rect.bottom >= m.bottom ? fg : NULL;
+	}
+
+	// Whether `upper` is higher in the z-order than `lower`, both top-level windows
+	static bool isAbove(HWND upper, HWND lower) {
+		for (HWND wnd = GetWindow(lower, GW_HWNDPREV); wnd; wnd = GetWindow(wnd, GW_HWNDPREV)) {
+			if (wnd == upper) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Auto-hidden taskbars leave a couple of pixels on screen
+	static bool onScreen(HWND bar) {
+		RECT rect;
+		MONITORINFO info = { .cbSize = sizeof(info) };
+		if (!IsWindowVisible(bar) || !GetWindowRect(bar, &rect)
+				|| !GetMonitorInfo(MonitorFromRect(&rect, MONITOR_DEFAULTTONEAREST), &info)) {
+			return false;
+		}
+		const RECT& m = info.rcMonitor;
+		int w = std::min(rect.right, m.right) - std::max(rect.left, m.left);
+		int h = std::min(rect.bottom, m.bottom) - std::max(rect.top, m.top);
+		return w > 4 && h > 4;
+	}
+
+public:
+	Visibility poll() override {
+		// The lock screen's desktop can't be opened
+		HDESK desk = OpenInputDesktop(0, FALSE, DESKTOP_READOBJECTS);
+		if (!desk) {
+			return Visibility::Locked;
+		}
+		CloseDesktop(desk);
+
+		// Maximized windows cover the monitor of an auto-hidden taskbar too, but a revealed taskbar stays on
+		// top of them while the shell drops it below real fullscreen windows
+		HWND fullscreen = fullscreenWindow();
+		HMONITOR covered = fullscreen ? MonitorFromWindow(fullscreen, MONITOR_DEFAULTTONULL) : NULL;
+		for (const BarWindow& bar : wb.bars) {
+			if (!onScreen(bar.bar)) {
+				continue;
+			}
+			if (!covered || MonitorFromWindow(bar.bar, MONITOR_DEFAULTTONEAREST) != covered
+					|| !isAbove(fullscreen, bar.bar)) {
+				return Visibility::Visible;
+			}
+		}
+		return wb.bars.empty() ? Visibility::Visible : Visibility::Hidden;
+	}
+};
+WindowsVisibility visibilitySource;
+PowerPolicy power(visibilitySource, WBLOCKS_TIMER_STRETCH, WBLOCKS_VISIBILITY_POLL_MS);
+
 struct BarBlocksState {
 	std::vector<Block*> blocks;
 	Block defaultBlock;
 	bool needsUpdate;
 	std::mutex mutex;
+	std::unordered_map<std::string, Block*> named; // What IPC pushes go to
+	std::unordered_set<Block*> pushed; // Created by a push to a name no block had
+	std::vector<Block*> retired; // Pushed blocks dropped, deleted once they're no longer drawn
 };
 BarBlocksState barBlocks;
 
+enum class ShellMode { Text, Bytes, Json };
+
 struct js_shell_thread_data {
 	std::thread thread;
 	JSValue resolveFn, rejectFn;
 	JSContext *ctx;
 	std::string cmd;
-
+	uint32_t script;
+	ShellMode mode;
+	std::vector<std::string> paths; // Selected from the JSON, all of it if empty
+	bool pathList; // Resolve to one value per path
+	ProcessOptions options;
+	JSValue signal = JS_UNDEFINED, abortListener = JS_UNDEFINED; // From the `signal` option
+	uint32_t id;
+
+	Process process;
 	bool success;
-	std::string result;
+	ProcessOutput output;
+	std::string error;
+	JsonDoc json;
+};
+
+enum class BlockEventType { Click, Scroll, Hover };
+
+struct BlockEvent {
+	Block *block;
+	BlockEventType type;
+	int value; // Button for clicks, wheel delta for scrolls, entered for hovers
+	int x; // Relative to the block
+	uint64_t queuedAt;
+};
+
+// JS input handlers per block, only touched on the JS thread
+struct BlockHandlers {
+	JSContext *ctx;
+	uint32_t script; // Script that set the handlers
+	JSValue onClick = JS_UNDEFINED, onScroll = JS_UNDEFINED, onHover = JS_UNDEFINED;
 };
-const char *jsShellTempCmd;
+std::unordered_map<Block*, BlockHandlers> jsBlockHandlers;
+
+void jsBlockEventDispatch(std::vector<void*>& args);
 
 void err(const char *err)
 {
-	fprintf(stderr, "wblocks error: %s\n", err);
+	logPrintf(LogLevel::Error, "wblocks", "%s", err);
 }
 
-void updateBlocks(HWND wnd)
+// Fully transparent pixels let clicks through, so interactive blocks get a barely visible alpha
+void markInteractive(SurfaceRaster& raster, const LayoutSpan& span)
 {
-	// Get taskbar size
-	GetWindowRect(wb.bar, &wb.barRect);
-	POINT pt = {
-		.x = (wb.barRect.right - wb.barRect.left) / 2,
-		.y = 0,
-	};
-	SIZE sz = {
-		.cx = (wb.barRect.right - wb.barRect.left) / 2,
-		.cy = wb.barRect.bottom - wb.barRect.top,
-	};
-#ifdef DEBUG
-	printf("Redraw - Pos: %ld, %ld, Size: %ld, %ld\n", pt.x, pt.y, sz.cx, sz.cy);
-#endif
+	for (int y = 0; y < raster.size.cy; y++) {
+		uint32_t *row = raster.pixels + y * raster.size.cx;
+		for (int x = std::max(span.x, 0); x < std::min(span.x + span.width, (int)raster.size.cx); x++) {
+			if (!(row[x] >> 24)) {
+				row[x] |= 0x01000000;
+			}
+		}
+	}
+}
 
-	// Begin paint
-	if (memcmp(&wb.lastSize, &sz, sizeof(sz))) {
-		if (wb.lastBitmap) {
-			DeleteObject(wb.lastBitmap);
+// Draws what a surface shows into its raster, recreating the bitmap if the size changed
+void drawSurface(const BarSurface& surface, SurfaceRaster& raster)
+{
+	SIZE sz = { .cx = surface.geometry.width, .cy = surface.geometry.height };
+	if (!raster.bitmap || memcmp(&raster.size, &sz, sizeof(sz))) {
+		if (raster.bitmap) {
+			DeleteObject(raster.bitmap);
 		}
-		wb.lastBitmap = CreateCompatibleBitmap(wb.screenHDC, sz.cx, sz.cy);
-		SelectObject(wb.hdc, wb.lastBitmap);
+		BITMAPINFO bmi = {
+			.bmiHeader = {
+				.biSize = sizeof(BITMAPINFOHEADER),
+				.biWidth = sz.cx,
+				.biHeight = -sz.cy,
+				.biPlanes = 1,
+				.biBitCount = 32,
+				.biCompression = BI_RGB,
+			},
+		};
+		raster.bitmap = CreateDIBSection(wb.screenHDC, &bmi, DIB_RGB_COLORS, (void**)&raster.pixels, NULL, 0);
+		raster.size = sz;
 	}
-	RECT rect = { .right = sz.cx, .bottom = sz.cy };
+	SelectObject(wb.hdc, raster.bitmap);
+	const Layout& layout = surface.layout.get();
+	auto blockOf = [&surface](size_t i) {
+		return barBlocks.blocks[surface.items[i]];
+	};
 
 	// Draw blocks
+	PatBlt(wb.hdc, 0, 0, sz.cx, sz.cy, BLACKNESS);
 	SetBkMode(wb.hdc, TRANSPARENT);
-	std::for_each(barBlocks.blocks.rbegin(), barBlocks.blocks.rend(), [&rect, &sz](const Block *block) {
-		block->drawBlock(wb.hdc, &rect);
-	});
+	for (size_t i = 0; i < surface.items.size(); i++) {
+		if (layout.spans[i].shown) {
+			blockOf(i)->drawBlock(wb.hdc, layout.spans[i], sz.cy);
+		}
+	}
+
+	// Draw separators in the color of the block before them
+	for (const LayoutSeparator& sep : layout.separators) {
+		RECT line = { .left = sep.x, .top = sz.cy / 5, .right = sep.x + 1, .bottom = sz.cy - sz.cy / 5 };
+		HBRUSH brush = CreateSolidBrush(blockOf(sep.item)->color);
+		FillRect(wb.hdc, &line, brush);
+		DeleteObject(brush);
+	}
+
+	GdiFlush();
+	for (size_t i = 0; i < surface.items.size(); i++) {
+		const LayoutSpan& span = layout.spans[i];
+		if (span.shown) {
+			blockOf(i)->compositeBlock(raster.pixels, sz, span);
+		}
+		if (span.shown && blockOf(i)->interactive) {
+			markInteractive(raster, span);
+		}
+	}
+	stats.barSurfacesDrawn.add();
+}
 
-	// Update
+// Copies a raster to every bar of its surface, only `dirty` of it if not NULL
+void presentSurface(const BarSurface& surface, const SurfaceRaster& raster, const RECT *dirty)
+{
 	POINT ptSrc = {0, 0};
 	BLENDFUNCTION blendfn = {
 		.BlendOp = AC_SRC_OVER,
 		.SourceConstantAlpha = 255,
 		.AlphaFormat = AC_SRC_ALPHA,
 	};
-	UpdateLayeredWindow(wnd, wb.screenHDC, &pt, &sz, wb.hdc, &ptSrc, 0, &blendfn, ULW_ALPHA);
+	SIZE size = raster.size;
+	for (size_t i : surface.bars) {
+		POINT pt = { .x = (wb.bars[i].barRect.right - wb.bars[i].barRect.left) / 2, .y = 0 };
+		UPDATELAYEREDWINDOWINFO info = {
+			.cbSize = sizeof(info),
+			.hdcDst = wb.screenHDC,
+			.pptDst = &pt,
+			.psize = &size,
+			.hdcSrc = wb.hdc,
+			.pptSrc = &ptSrc,
+			.pblend = &blendfn,
+			.dwFlags = ULW_ALPHA,
+			.prcDirty = dirty,
+		};
+		UpdateLayeredWindowIndirect(wb.bars[i].wnd, &info);
+		stats.barPresents.add();
+	}
+}
+
+void updateBlocks()
+{
+	uint64_t start = nowUs();
+
+	// Get taskbar sizes, blocks get the right half of each
+	std::vector<BarGeometry> geometries;
+	geometries.reserve(wb.bars.size());
+	for (BarWindow& bar : wb.bars) {
+		GetWindowRect(bar.bar, &bar.barRect);
+		geometries.push_back({
+			.width = (bar.barRect.right - bar.barRect.left) / 2,
+			.height = bar.barRect.bottom - bar.barRect.top,
+			.dpi = (int)GetDpiForWindow(bar.bar),
+		});
+	}
+
+	// Layout blocks once per surface, only text that changed gets measured
+	std::vector<LayoutItem> items;
+	std::vector<BarMask> masks;
+	items.reserve(barBlocks.blocks.size());
+	masks.reserve(barBlocks.blocks.size());
+	for (Block *block : barBlocks.blocks) {
+		items.push_back(block->layoutItem(wb.hdc));
+		masks.push_back(block->bars);
+	}
+	bool replanned = wb.planner.plan(geometries, masks);
+	if (replanned) {
+		// Rasters past the new surface count are dropped, the rest get resized as they're drawn
+		for (size_t i = wb.planner.get().size(); i < wb.rasters.size(); i++) {
+			DeleteObject(wb.rasters[i].bitmap);
+		}
+		wb.rasters.resize(wb.planner.get().size());
+	}
+	std::vector<bool> changed;
+	wb.planner.layout(items, changed);
+	wb.drawnBlocks = barBlocks.blocks;
+	for (Block *block : barBlocks.blocks) {
+		if (block->animate(start)) {
+			block->dirty = true;
+		}
+	}
+	for (Block *block : barBlocks.retired) {
+		delete block;
+	}
+	barBlocks.retired.clear();
+
+	// Draw each surface once and present it to all its bars, skipping those that would come out the same
+	for (size_t s = 0; s < wb.planner.get().size(); s++) {
+		const BarSurface& surface = wb.planner.get()[s];
+		SurfaceRaster& raster = wb.rasters[s];
+		bool redraw = replanned || changed[s] || !raster.bitmap;
+		for (size_t i = 0; i < surface.items.size() && !redraw; i++) {
+			redraw = barBlocks.blocks[surface.items[i]]->dirty;
+		}
+		if (!redraw) {
+			stats.barSurfacesSkipped.add();
+			continue;
+		}
+		drawSurface(surface, raster);
+		uint64_t presentStart = nowUs();
+		trace(TraceOp::Redraw, surface.bars[0], {raster.size.cx, raster.size.cy, (int64_t)(presentStart - start),
+				surface.geometry.dpi});
+#ifdef DEBUG
+		printf("Redraw - Surface: %zu, Size: %ld, %ld, Bars: %zu\n", s, raster.size.cx, raster.size.cy, surface.bars.size());
+#endif
+		presentSurface(surface, raster, NULL);
+		trace(TraceOp::Present, surface.bars[0], {(int64_t)(nowUs() - presentStart)});
+		start = nowUs();
+	}
+	for (Block *block : barBlocks.blocks) {
+		block->dirty = false;
+	}
+}
+
+// Advances the animated blocks to the current frame and redraws only the spans of those that moved, between
+// full redraws. The blocks are the ones last laid out.
+void drawAnimations(uint64_t frameUs)
+{
+	uint64_t start = nowUs();
+	std::vector<bool> moved(wb.drawnBlocks.size());
+	bool anyMoved = false;
+	for (size_t i = 0; i < wb.drawnBlocks.size(); i++) {
+		moved[i] = wb.drawnBlocks[i]->animate(frameUs);
+		anyMoved = anyMoved || moved[i];
+	}
+	if (!anyMoved) {
+		return;
+	}
+
+	size_t regions = 0;
+	std::vector<size_t> redrawn;
+	for (size_t s = 0; s < wb.planner.get().size(); s++) {
+		const BarSurface& surface = wb.planner.get()[s];
+		SurfaceRaster& raster = wb.rasters[s];
+		const Layout& layout = surface.layout.get();
+		if (!raster.bitmap) {
+			continue;
+		}
+		SelectObject(wb.hdc, raster.bitmap);
+		RECT dirty = {};
+		redrawn.clear();
+		for (size_t i = 0; i < surface.items.size(); i++) {
+			const LayoutSpan& span = layout.spans[i];
+			Block *block = wb.drawnBlocks[surface.items[i]];
+			RECT rect = { .left = std::max(span.x, 0), .top = 0,
+					.right = std::min(span.x + span.width, (int)raster.size.cx), .bottom = raster.size.cy };
+			if (!moved[surface.items[i]] || !span.shown || !block->animatesIn(span) || rect.left >= rect.right) {
+				continue;
+			}
+			PatBlt(wb.hdc, rect.left, 0, rect.right - rect.left, rect.bottom, BLACKNESS);
+			block->drawBlock(wb.hdc, span, raster.size.cy);
+			UnionRect(&dirty, &dirty, &rect);
+			redrawn.push_back(i);
+		}
+		if (redrawn.empty()) {
+			continue;
+		}
+		GdiFlush();
+		for (size_t i : redrawn) {
+			Block *block = wb.drawnBlocks[surface.items[i]];
+			block->compositeBlock(raster.pixels, raster.size, layout.spans[i]);
+			if (block->interactive) {
+				markInteractive(raster, layout.spans[i]);
+			}
+		}
+		presentSurface(surface, raster, &dirty);
+		regions += redrawn.size();
+	}
+	if (regions) {
+		uint64_t took = nowUs() - start;
+		stats.animationFrames.record(took);
+		stats.animatedRegionsDrawn.add(regions);
+		trace(TraceOp::Animate, 0, {(int64_t)regions, (int64_t)took});
+	}
+}
+
+// Attaches to a taskbar, the window's WM_CREATE finishing the job in `initWnd`
+void createBarWindow(HWND bar)
+{
+	BarWindow& barWnd = wb.bars.emplace_back(BarWindow{ .bar = bar });
+	GetWindowRect(bar, &barWnd.barRect);
+	if (!CreateWindowEx(WS_EX_LAYERED, WBLOCKS_BAR_CLASS, "wblocks2_bar", 0, 0, 0, 0, 0, bar, 0, 0, 0)) {
+		err("failed to create a bar window");
+		wb.bars.pop_back();
+	}
+}
+
+// Attaches to the taskbars of monitors that showed up since the last scan
+void scanSecondaryBars()
+{
+	wb.lastBarScan = nowUs();
+	bool added = false;
+	for (HWND tray = NULL; (tray = FindWindowEx(NULL, tray, "Shell_SecondaryTrayWnd", NULL)) && wb.bars.size() < BAR_MAX;) {
+		bool known = std::any_of(wb.bars.begin(), wb.bars.end(), [tray](const BarWindow& bar) {
+			return bar.bar == tray;
+		});
+		if (!known) {
+			createBarWindow(tray);
+			added = true;
+		}
+	}
+	if (!added) {
+		return;
+	}
+
+	// Bar numbers go left to right after the primary, whatever order the monitors were plugged in
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	std::sort(wb.bars.begin() + 1, wb.bars.end(), [](const BarWindow& a, const BarWindow& b) {
+		return a.barRect.left != b.barRect.left ? a.barRect.left < b.barRect.left : a.barRect.top < b.barRect.top;
+	});
+	barBlocks.needsUpdate = true;
 }
 
 void checkBarSize()
 {
-	if (wb.wnd) {
+	if (wb.bars.empty()) {
+		return;
+	}
+	if (nowUs() - wb.lastBarScan >= WBLOCKS_BAR_SCAN_MS * 1000) {
+		scanSecondaryBars();
+	}
+	for (const BarWindow& bar : wb.bars) {
 		RECT cmpRect;
-		if (!GetWindowRect(wb.bar, &cmpRect)) {
-			err("failed to get tray size");
-			DestroyWindow(wb.wnd);
+		if (!GetWindowRect(bar.bar, &cmpRect)) {
+			if (bar.wnd == wb.bars[0].wnd) {
+				err("failed to get tray size");
+			}
+			DestroyWindow(bar.wnd);
 			return;
 		}
-		if (memcmp(&cmpRect, &wb.barRect, sizeof(RECT))) {
-			updateBlocks(wb.wnd);
+		if (memcmp(&cmpRect, &bar.barRect, sizeof(RECT))) {
+			std::lock_guard<std::mutex> lock(barBlocks.mutex);
+			if (power.shouldDraw(true)) {
+				updateBlocks();
+			}
+			return;
 		}
 	}
 }
@@ -198,33 +949,43 @@ void createWindow()
 		err("failed to find tray");
 		return;
 	}
-	wb.bar = FindWindowEx(tray, NULL, "ReBarWindow32", NULL);
-	if (!wb.bar) {
+	HWND bar = FindWindowEx(tray, NULL, "ReBarWindow32", NULL);
+	if (!bar) {
 		err("failed to find taskbar");
 		return;
 	}
 
-	// Create window
-	assert(CreateWindowEx(
-			WS_EX_LAYERED, WBLOCKS_BAR_CLASS, "wblocks2_bar",
-			0, 0, 0, 0, 0, wb.bar, 0, 0, 0));
+	// Create window, then the ones for other monitors
+	createBarWindow(bar);
+	if (!wb.bars.empty()) {
+		scanSecondaryBars();
+	}
 }
 
 void CALLBACK retryCreateWindow(HWND _a, UINT _b, UINT _c, DWORD _d)
 {
 	createWindow();
-	if (wb.wnd) {
+	if (!wb.bars.empty()) {
 		KillTimer(NULL, createWindowTimer);
 	}
 }
 
 void initWnd(HWND wnd)
 {
-	wb.wnd = wnd;
+	BarWindow& bar = wb.bars.back(); // Pushed by `createBarWindow` right before creating the window
+	bar.wnd = wnd;
+	SetParent(wnd, bar.bar);
+	if (wb.bars.size() > 1) {
+		std::lock_guard<std::mutex> lock(barBlocks.mutex);
+		barBlocks.needsUpdate = true;
+		return;
+	}
+
 	wb.screenHDC = GetDC(NULL);
 	wb.hdc = CreateCompatibleDC(wb.screenHDC);
-	SetParent(wnd, wb.bar);
-	updateBlocks(wnd);
+	barBlocks.mutex.lock();
+	updateBlocks();
+	barBlocks.mutex.unlock();
 
 	// Show tray icon
 	NOTIFYICONDATA notifData = {
@@ -238,21 +999,126 @@ void initWnd(HWND wnd)
 	Shell_NotifyIcon(NIM_ADD, &notifData);
 }
 
+// Forgets a bar on a monitor that went away
+void removeBar(HWND wnd)
+{
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	auto it = std::find_if(wb.bars.begin(), wb.bars.end(), [wnd](const BarWindow& bar) {
+		return bar.wnd == wnd;
+	});
+	if (it != wb.bars.end()) {
+		wb.bars.erase(it);
+		barBlocks.needsUpdate = true;
+	}
+}
+
 void cleanupWnd()
 {
-	if (wb.lastBitmap) {
-		DeleteObject(wb.lastBitmap);
+	for (SurfaceRaster& raster : wb.rasters) {
+		DeleteObject(raster.bitmap);
 	}
 	DeleteDC(wb.hdc);
 	ReleaseDC(NULL, wb.screenHDC);
-	NOTIFYICONDATA notifData = { .cbSize = sizeof(notifData), .hWnd = wb.wnd };
-	Shell_NotifyIcon(NIM_DELETE, &notifData);
+	std::vector<HWND> secondary;
+	if (!wb.bars.empty()) {
+		NOTIFYICONDATA notifData = { .cbSize = sizeof(notifData), .hWnd = wb.bars[0].wnd };
+		Shell_NotifyIcon(NIM_DELETE, &notifData);
+		for (size_t i = 1; i < wb.bars.size(); i++) {
+			secondary.push_back(wb.bars[i].wnd);
+		}
+	}
+	barBlocks.mutex.lock();
 	wb = {};
+	barBlocks.mutex.unlock();
+
+	// Taken down with the primary, so all of them come back together
+	for (HWND wnd : secondary) {
+		DestroyWindow(wnd);
+	}
 	createWindowTimer = SetTimer(NULL, 0, 3000, (TIMERPROC)retryCreateWindow);
 }
 
+void showStats()
+{
+	FILE *f = fopen(WBLOCKS_STATSFILE, "w");
+	if (!f) {
+		err("failed to write stats");
+		return;
+	}
+	std::string str = formatStats();
+	fwrite(str.data(), 1, str.size(), f);
+	fclose(f);
+	ShellExecute(NULL, NULL, WBLOCKS_STATSFILE, NULL, NULL, SW_SHOWNORMAL);
+}
+
+// Records from the current state of every block on, so a trace can start anywhere in a session
+void startTrace(const char *path)
+{
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	std::string traceErr;
+	if (!traceStart(path, traceErr)) {
+		err(traceErr.c_str());
+		return;
+	}
+	barBlocks.defaultBlock.traceAll();
+	for (Block *block : barBlocks.blocks) {
+		trace(TraceOp::Create, block->traceId, {0});
+		block->traceAll();
+	}
+}
+
+BarWindow *barOf(HWND wnd)
+{
+	for (BarWindow& bar : wb.bars) {
+		if (bar.wnd == wnd) {
+			return &bar;
+		}
+	}
+	return nullptr;
+}
+
+// Finds the interactive block at a client x coordinate of a bar, ran on the UI thread
+Block *blockAt(HWND wnd, int x, int *blockX)
+{
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	BarWindow *bar = barOf(wnd);
+	if (!bar) {
+		return nullptr;
+	}
+	size_t index = bar - wb.bars.data();
+	if (index >= wb.planner.barCount()) {
+		return nullptr; // Not drawn yet
+	}
+	const BarSurface& surface = wb.planner.get()[wb.planner.surfaceOf(index)];
+	int item = surface.hits.find(x);
+	if (item < 0 || !wb.drawnBlocks[surface.items[item]]->interactive) {
+		return nullptr;
+	}
+	*blockX = x - surface.layout.get().spans[item].x;
+	return wb.drawnBlocks[surface.items[item]];
+}
+
+void queueBlockEvent(Block *block, BlockEventType type, int value, int x)
+{
+	stats.inputEvents.add();
+	auto ev = new BlockEvent{ .block = block, .type = type, .value = value, .x = x, .queuedAt = nowUs() };
+	jsThreadQueueMutex.lock();
+	jsThreadQueue.push_back(std::make_pair(jsBlockEventDispatch, std::vector({(void*)ev})));
+	jsThreadQueueMutex.unlock();
+}
+
+// Used on the JS thread, `restartProgram` closes it from the UI thread
+KVStore kvStore;
+std::mutex kvMutex;
+
 void restartProgram()
 {
+	// The new instance can't open the store while this one has it mapped, a closed store fails every call
+	{
+		std::lock_guard<std::mutex> lock(kvMutex);
+		kvStore.close();
+	}
+
 	STARTUPINFO si;
 	GetStartupInfo(&si);
 	TCHAR szPath[MAX_PATH + 1];
@@ -273,286 +1139,1929 @@ LRESULT CALLBACK wndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		initWnd(wnd);
 		break;
 	case WM_NCDESTROY:
-		cleanupWnd();
-		err("wblocks window died, probably due to explorer.exe crashing");
+		if (!wb.bars.empty() && wnd != wb.bars[0].wnd) {
+			removeBar(wnd);
+			break;
+		}
+		if (!wb.bars.empty()) {
+			cleanupWnd();
+			err("wblocks window died, probably due to explorer.exe crashing");
+		}
 		break;
-	case WM_WBLOCKS_TRAY:
-		if (LOWORD(lParam) == WM_LBUTTONUP || LOWORD(lParam) == WM_RBUTTONUP) {
-			POINT pt;
-			GetCursorPos(&pt);
-			HMENU hmenu = CreatePopupMenu();
-			InsertMenu(hmenu, 0, MF_BYPOSITION | MF_STRING, TRAY_MENU_SHOW_LOG, "Show Log");
-			InsertMenu(hmenu, 1, MF_BYPOSITION | MF_STRING, TRAY_MENU_RESTART, "Restart");
-			InsertMenu(hmenu, 2, MF_BYPOSITION | MF_STRING, TRAY_MENU_EXIT, "Exit");
-			SetForegroundWindow(wnd);
+	case WM_LBUTTONUP:
+	case WM_MBUTTONUP:
+	case WM_RBUTTONUP: {
+		int x;
+		Block *block = blockAt(wnd, (short)LOWORD(lParam), &x);
+		if (block) {
+			int button = msg == WM_LBUTTONUP ? 0 : msg == WM_MBUTTONUP ? 1 : 2;
+			queueBlockEvent(block, BlockEventType::Click, button, x);
+		}
+		break;
+	}
+	case WM_MOUSEWHEEL: {
+		POINT pt = { .x = (short)LOWORD(lParam), .y = (short)HIWORD(lParam) };
+		ScreenToClient(wnd, &pt);
+		int x;
+		Block *block = blockAt(wnd, pt.x, &x);
+		if (block) {
+			queueBlockEvent(block, BlockEventType::Scroll, GET_WHEEL_DELTA_WPARAM(wParam), x);
+		}
+		break;
+	}
+	case WM_MOUSEMOVE: {
+		BarWindow *bar = barOf(wnd);
+		if (!bar) {
+			break;
+		}
+		if (!bar->trackingMouse) {
+			TRACKMOUSEEVENT tme = { .cbSize = sizeof(tme), .dwFlags = TME_LEAVE, .hwndTrack = wnd };
+			bar->trackingMouse = TrackMouseEvent(&tme);
+		}
+		int x;
+		Block *block = blockAt(wnd, (short)LOWORD(lParam), &x);
+		if (block != bar->hovered) {
+			if (bar->hovered) {
+				queueBlockEvent(bar->hovered, BlockEventType::Hover, false, 0);
+			}
+			if (block) {
+				queueBlockEvent(block, BlockEventType::Hover, true, x);
+			}
+			bar->hovered = block;
+		}
+		break;
+	}
+	case WM_MOUSELEAVE: {
+		BarWindow *bar = barOf(wnd);
+		if (!bar) {
+			break;
+		}
+		bar->trackingMouse = false;
+		if (bar->hovered) {
+			queueBlockEvent(bar->hovered, BlockEventType::Hover, false, 0);
+			bar->hovered = nullptr;
+		}
+		break;
+	}
+	case WM_WBLOCKS_TRAY:
+		if (LOWORD(lParam) == WM_LBUTTONUP || LOWORD(lParam) == WM_RBUTTONUP) {
+			POINT pt;
+			GetCursorPos(&pt);
+			HMENU hmenu = CreatePopupMenu();
+			InsertMenu(hmenu, 0, MF_BYPOSITION | MF_STRING, TRAY_MENU_SHOW_LOG, "Show Log");
+			InsertMenu(hmenu, 1, MF_BYPOSITION | MF_STRING, TRAY_MENU_SHOW_STATS, "Show Stats");
+			InsertMenu(hmenu, 2, MF_BYPOSITION | MF_STRING, TRAY_MENU_TRACE, traceActive ? "Stop Trace" : "Record Trace");
+			InsertMenu(hmenu, 3, MF_BYPOSITION | MF_STRING, TRAY_MENU_RESTART, "Restart");
+			InsertMenu(hmenu, 4, MF_BYPOSITION | MF_STRING, TRAY_MENU_EXIT, "Exit");
+			SetForegroundWindow(wnd);
 			int cmd = TrackPopupMenu(hmenu,
 					TPM_LEFTALIGN | TPM_LEFTBUTTON | TPM_BOTTOMALIGN | TPM_NONOTIFY | TPM_RETURNCMD,
 					pt.x, pt.y, 0, wnd, NULL);
 			PostMessage(wnd, WM_NULL, 0, 0);
 			if (cmd == TRAY_MENU_SHOW_LOG) {
 				ShellExecute(NULL, NULL, WBLOCKS_LOGFILE, NULL, NULL, SW_SHOWNORMAL);
+			} else if (cmd == TRAY_MENU_SHOW_STATS) {
+				showStats();
+			} else if (cmd == TRAY_MENU_TRACE) {
+				if (traceActive) {
+					traceStop();
+				} else {
+					startTrace(WBLOCKS_TRACEFILE);
+				}
 			} else if (cmd == TRAY_MENU_RESTART) {
 				cleanupWnd();
+				traceStop();
 				restartProgram(); // TODO: opt for proper reload instead
 			} else if (cmd == TRAY_MENU_EXIT) {
 				cleanupWnd();
+				traceStop();
 				exit(0);
 			}
 		}
 	}
 
-	return DefWindowProc(wnd, msg, wParam, lParam);
+	return DefWindowProc(wnd, msg, wParam, lParam);
+}
+
+template<JSCFunction *fn>
+JSValue jsWrapBlockFn(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+#ifdef DEBUG
+	printf("FN %lld\n", (size_t)fn);
+#endif
+	barBlocks.mutex.lock();
+	JSValue ret = fn(ctx, thiz, argc, argv);
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+	return ret;
+}
+
+LogRateLimiter jsLogLimiter(WBLOCKS_LOG_RATE, WBLOCKS_LOG_BURST);
+
+// Backs `console.*`, takes a level from `LogLevel` and a message
+JSValue jsLog(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 2 || !JS_IsNumber(argv[0]) || !JS_IsString(argv[1])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	int level = std::clamp(JS_VALUE_GET_INT(argv[0]), (int)LogLevel::Info, (int)LogLevel::Error);
+	const std::string& source = scriptInfos[currentScript].name;
+	uint64_t suppressed;
+	if (!jsLogLimiter.allow(source, nowUs(), &suppressed)) {
+		stats.logSuppressed.add();
+		return JS_UNDEFINED;
+	}
+	if (suppressed) {
+		logPrintf(LogLevel::Warn, source.c_str(), "%llu lines suppressed by rate limit", (unsigned long long)suppressed);
+	}
+	size_t len;
+	const char *str = JS_ToCStringLen(ctx, &len, argv[1]);
+	logWrite((LogLevel)level, source.c_str(), str, len);
+	JS_FreeCString(ctx, str);
+	return JS_UNDEFINED;
+}
+
+// Runs queued Promise jobs right away so they are attributed to the current script
+void jsRunPendingJobs(JSContext *ctx)
+{
+	JSContext *jobCtx;
+	int ret;
+	uint32_t script = currentScript;
+	while ((ret = JS_ExecutePendingJob(JS_GetRuntime(ctx), &jobCtx))) {
+		if (ret < 0) {
+			js_std_dump_error(jobCtx);
+			if (currentScript != script) {
+				enterScript(script); // An interrupt switched to lib, the jobs left are still the script's
+			}
+		}
+	}
+}
+
+// For lib.mjs to run the continuations of a callback inside its script
+JSValue jsRunPendingJobsFn(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	jsRunPendingJobs(ctx);
+	return JS_UNDEFINED;
+}
+
+uint64_t jsLastMemorySample;
+
+void sampleJSMemory(JSRuntime *rt)
+{
+	JSMemoryUsage usage;
+	JS_ComputeMemoryUsage(rt, &usage);
+	stats.jsHeapBytes.set(usage.malloc_size);
+	stats.jsHeapPeak.set(std::max(stats.jsHeapPeak.value.load(), usage.malloc_size));
+	stats.jsHeapLimit.set(usage.malloc_limit);
+	stats.jsObjects.set(usage.obj_count);
+	stats.jsStrings.set(usage.str_count);
+}
+
+// Used to run events that need to be ran on the JS thread
+JSValue jsYieldToC(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	// Swap the queue out so other threads aren't blocked while the events run
+	decltype(jsThreadQueue) queue;
+	jsThreadQueueMutex.lock();
+	queue.swap(jsThreadQueue);
+	jsThreadQueueMutex.unlock();
+	for (auto& item : queue) {
+		item.first(item.second);
+	}
+
+	uint64_t now = nowUs();
+	if (now - jsLastMemorySample >= WBLOCKS_JS_MEMORY_SAMPLE_US) {
+		jsLastMemorySample = now;
+		sampleJSMemory(JS_GetRuntime(ctx));
+	}
+	return JS_UNDEFINED;
+}
+
+// Registers a script by name, returning its id
+JSValue jsRegisterScript(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsString(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	const char *name = JS_ToCString(ctx, argv[0]);
+	uint32_t id = registerScript(name);
+	JS_FreeCString(ctx, name);
+	return JS_NewInt32(ctx, id);
+}
+
+// Attributes everything that runs from now on to a script, returning the previous one
+JSValue jsEnterScript(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsNumber(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	return JS_NewInt32(ctx, enterScript(JS_VALUE_GET_INT(argv[0])));
+}
+
+JSValue jsCurrentScript(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return JS_NewInt32(ctx, currentScript);
+}
+
+JSValue jsScriptDisabled(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsNumber(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	uint32_t id = JS_VALUE_GET_INT(argv[0]);
+	return JS_NewBool(ctx, id < scriptCount.load(std::memory_order_relaxed) && scriptDisabled(id));
+}
+
+// Calls `fn`, returning what it threw instead of throwing, which also stops budget interrupts
+JSValue jsIsolate(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsFunction(ctx, argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	JSValue ret = JS_Call(ctx, argv[0], JS_UNDEFINED, 0, NULL);
+	if (JS_IsException(ret)) {
+		return JS_GetException(ctx);
+	}
+	JS_FreeValue(ctx, ret);
+	return JS_UNDEFINED;
+}
+
+// Stops a callback that runs past its budget, QuickJS calls this every few thousand instructions
+int jsInterruptHandler(JSRuntime *rt, void *opaque)
+{
+	return checkScriptBudget();
+}
+
+JSValue jsSetCallbackBudget(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	int64_t ms;
+	if (argc != 1 || !JS_IsNumber(argv[0]) || JS_ToInt64(ctx, &ms, argv[0]) || ms <= 0) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	callbackBudgetUs = ms * 1000;
+	return JS_UNDEFINED;
+}
+
+JSValue jsSetTimerStretch(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	double factor;
+	if (argc != 1 || JSArg<double>::get(ctx, argv[0], factor)) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	if (!(factor >= 1 && factor <= POWER_MAX_TIMER_STRETCH)) {
+		return JS_ThrowRangeError(ctx, "Timer stretch must be between 1 and %d", POWER_MAX_TIMER_STRETCH);
+	}
+	power.setTimerStretch(factor);
+	return JS_UNDEFINED;
+}
+
+// For lib.mjs to stretch timer delays by
+JSValue jsTimerStretch(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return JS_NewFloat64(ctx, power.timerStretch());
+}
+
+JSValue jsSetMemoryLimit(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	int64_t limit;
+	if (argc != 1 || !JS_IsNumber(argv[0]) || JS_ToInt64(ctx, &limit, argv[0]) || limit < 0) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	JS_SetMemoryLimit(JS_GetRuntime(ctx), limit ? limit : -1);
+	return JS_UNDEFINED;
+}
+
+JSValue jsSetGCThreshold(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	int64_t threshold;
+	if (argc != 1 || !JS_IsNumber(argv[0]) || JS_ToInt64(ctx, &threshold, argv[0]) || threshold <= 0) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	JS_SetGCThreshold(JS_GetRuntime(ctx), threshold);
+	return JS_UNDEFINED;
+}
+
+JSValue jsMemoryUsage(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	JSMemoryUsage usage;
+	JS_ComputeMemoryUsage(JS_GetRuntime(ctx), &usage);
+	JSValue obj = JS_NewObject(ctx);
+	JS_SetPropertyStr(ctx, obj, "heapBytes", JS_NewInt64(ctx, usage.malloc_size));
+	JS_SetPropertyStr(ctx, obj, "heapLimit", JS_NewInt64(ctx, usage.malloc_limit));
+	JS_SetPropertyStr(ctx, obj, "allocations", JS_NewInt64(ctx, usage.malloc_count));
+	JS_SetPropertyStr(ctx, obj, "objects", JS_NewInt64(ctx, usage.obj_count));
+	JS_SetPropertyStr(ctx, obj, "strings", JS_NewInt64(ctx, usage.str_count));
+	JS_SetPropertyStr(ctx, obj, "functions", JS_NewInt64(ctx, usage.js_func_count));
+
+	JSValue scripts = JS_NewObject(ctx);
+	for (uint32_t i = 0; i < scriptCount.load(std::memory_order_acquire); i++) {
+		JS_SetPropertyStr(ctx, scripts, scriptInfos[i].name.c_str(), JS_NewInt64(ctx, scriptInfos[i].heapBytes.load()));
+	}
+	JS_SetPropertyStr(ctx, obj, "scripts", scripts);
+	return obj;
+}
+
+uint32_t nextBlockTraceId = 1;
+
+Block *newBlock(const Block& srcBlock)
+{
+	Block *block = new Block(srcBlock);
+	block->interactive = false;
+	block->graph = nullptr;
+	block->traceId = nextBlockTraceId++;
+	barBlocks.blocks.push_back(block);
+	trace(TraceOp::Create, block->traceId, {srcBlock.traceId});
+	return block;
+}
+
+JSValue createJSBlockFromSrc(JSContext *ctx, Block *srcBlock)
+{
+	Block *block = newBlock(*srcBlock);
+	JSValue obj = JS_NewObjectClass(ctx, jsBlockClassId);
+	JS_SetOpaque(obj, block);
+	return obj;
+}
+
+JSValue jsCreateBlock(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return createJSBlockFromSrc(ctx, &barBlocks.defaultBlock);
+}
+
+static inline Block *getBlockThis(JSValueConst thiz)
+{
+	return (Block*)JS_GetOpaque(thiz, jsBlockClassId);
+}
+
+template<>
+struct JSArg<LayoutGroup> {
+	static const char *get(JSContext *ctx, JSValueConst val, LayoutGroup& out) {
+		if (!JS_IsString(val)) {
+			return jsArgInvalid;
+		}
+		const char *name = JS_ToCString(ctx, val);
+		const char *err = NULL;
+		if (!strcmp(name, "left")) {
+			out = LayoutGroup::Left;
+		} else if (!strcmp(name, "center")) {
+			out = LayoutGroup::Center;
+		} else if (!strcmp(name, "right")) {
+			out = LayoutGroup::Right;
+		} else {
+			err = "Group must be 'left', 'center' or 'right'";
+		}
+		JS_FreeCString(ctx, name);
+		return err;
+	}
+};
+
+template<>
+struct JSArg<LayoutOverflow> {
+	static const char *get(JSContext *ctx, JSValueConst val, LayoutOverflow& out) {
+		if (!JS_IsString(val)) {
+			return jsArgInvalid;
+		}
+		const char *mode = JS_ToCString(ctx, val);
+		const char *err = NULL;
+		if (!strcmp(mode, "hide")) {
+			out = LayoutOverflow::Hide;
+		} else if (!strcmp(mode, "ellipsize")) {
+			out = LayoutOverflow::Ellipsize;
+		} else {
+			err = "Overflow must be 'hide' or 'ellipsize'";
+		}
+		JS_FreeCString(ctx, mode);
+		return err;
+	}
+};
+
+static double jsGetNumberProp(JSContext *ctx, JSValueConst obj, const char *name, double def)
+{
+	JSValue val = JS_GetPropertyStr(ctx, obj, name);
+	double num = def;
+	if (JS_IsNumber(val)) {
+		JS_ToFloat64(ctx, &num, val);
+	}
+	JS_FreeValue(ctx, val);
+	return num;
+}
+
+// Saturates a count or duration to what `T` holds, NaN and negatives giving 0
+template<typename T>
+static T jsClampUnsigned(double num)
+{
+	constexpr T max = std::numeric_limits<T>::max();
+	return !(num > 0) ? 0 : num >= (double)max ? max : (T)num;
+}
+
+// `{type: 'marquee' | 'fade' | 'blink', speed, gap, period, minAlpha}`, or null for none
+template<>
+struct JSArg<Animation> {
+	static const char *get(JSContext *ctx, JSValueConst val, Animation& out) {
+		out = {};
+		if (JS_IsNull(val)) {
+			return NULL;
+		}
+		if (!JS_IsObject(val)) {
+			return jsArgInvalid;
+		}
+		JSValue typeVal = JS_GetPropertyStr(ctx, val, "type");
+		const char *type = JS_IsString(typeVal) ? JS_ToCString(ctx, typeVal) : NULL;
+		JS_FreeValue(ctx, typeVal);
+		if (!type) {
+			return jsArgInvalid;
+		}
+		const char *err = NULL;
+		if (!strcmp(type, "marquee")) {
+			out.kind = AnimationKind::Marquee;
+		} else if (!strcmp(type, "fade")) {
+			out.kind = AnimationKind::Fade;
+		} else if (!strcmp(type, "blink")) {
+			out.kind = AnimationKind::Blink;
+		} else {
+			err = "Animation type must be 'marquee', 'fade' or 'blink'";
+		}
+		JS_FreeCString(ctx, type);
+		if (err) {
+			return err;
+		}
+
+		double speed = jsGetNumberProp(ctx, val, "speed", out.speed);
+		double gap = jsGetNumberProp(ctx, val, "gap", out.gap);
+		double period = jsGetNumberProp(ctx, val, "period", out.periodMs);
+		double minAlpha = jsGetNumberProp(ctx, val, "minAlpha", out.minAlpha);
+		if (!(speed >= 1 && speed <= 1000)) {
+			return "Marquee speed must be between 1 and 1000 pixels per second";
+		}
+		if (!(gap >= 0 && gap <= 1000)) {
+			return "Marquee gap must be between 0 and 1000 pixels";
+		}
+		if (!(period >= 50 && period <= 60000)) {
+			return "Animation period must be between 50 and 60000 ms";
+		}
+		if (!(minAlpha >= 0 && minAlpha <= 255)) {
+			return "Animation minAlpha must be between 0 and 255";
+		}
+		out.speed = speed;
+		out.gap = gap;
+		out.periodMs = period;
+		out.minAlpha = minAlpha;
+		return NULL;
+	}
+};
+
+// Block setters, bound to JS by their signature with `jsBlockSetter`. Called with `barBlocks.mutex` held, after
+// their arguments were converted without it.
+
+// TODO: make size an optional parameter, retaining size if not given
+static const char *blockSetFont(Block *block, std::string name, int size)
+{
+	bool ok = block->setFont(name, size);
+	block->traceState(TraceOp::Font);
+	return ok ? NULL : "Failed to load font";
+}
+
+static void blockSetText(Block *block, std::string text)
+{
+	block->setText(std::move(text));
+	block->traceState(TraceOp::Text);
+}
+
+static bool colorInRange(int r, int g, int b)
+{
+	return r >= 0 && r <= 255 && g >= 0 && g <= 255 && b >= 0 && b <= 255;
+}
+
+static JSRangeError blockSetColor(Block *block, int r, int g, int b)
+{
+	if (!colorInRange(r, g, b)) {
+		return { "Color components must be between 0 and 255" };
+	}
+	block->color = RGB(r, g, b);
+	block->traceState(TraceOp::Color);
+	return {};
+}
+
+static void blockSetPadding(Block *block, int left, int right)
+{
+	block->padLeft = left;
+	block->padRight = right;
+	block->traceState(TraceOp::Padding);
+}
+
+static void blockSetVisible(Block *block, bool visible)
+{
+	block->visible = visible;
+	block->traceState(TraceOp::Visible);
+}
+
+static void blockSetGroup(Block *block, LayoutGroup group)
+{
+	block->group = group;
+	block->traceState(TraceOp::Group);
+}
+
+static JSRangeError blockSetWidth(Block *block, int min, int max)
+{
+	if (min < 0 || max < 0 || (max && max < min)) {
+		return { "Width limits must not be negative, with max 0 or at least min" };
+	}
+	block->minWidth = min;
+	block->maxWidth = max;
+	block->traceState(TraceOp::Width);
+	return {};
+}
+
+static void blockSetPriority(Block *block, int priority)
+{
+	block->priority = priority;
+	block->traceState(TraceOp::Priority);
+}
+
+static void blockSetOverflow(Block *block, LayoutOverflow overflow)
+{
+	block->overflow = overflow;
+	block->traceState(TraceOp::Overflow);
+}
+
+static void blockSetSeparator(Block *block, bool separator)
+{
+	block->separator = separator;
+	block->traceState(TraceOp::Separator);
+}
+
+static void blockSetAnimation(Block *block, Animation animation)
+{
+	block->setAnimation(animation);
+	block->traceState(TraceOp::Animation);
+}
+
+// Not wrapped, converting objects like an animation reads their properties, which may run JS
+template<auto setter>
+JSValue jsBlockSetter(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return jsCallSetter<setter>(ctx, getBlockThis(thiz), argc, argv, [](auto call) {
+		std::lock_guard<std::mutex> lock(barBlocks.mutex);
+		JSValue ret = call();
+		barBlocks.needsUpdate = true;
+		return ret;
+	});
+}
+
+#define WBLOCKS_SET_MAX_ARGS 3
+
+// What `block.set` takes, by the names of the setters
+static constexpr JSSetterProp<Block> jsBlockProps[] = {
+	jsSetterProp<blockSetFont, Block>("font"),
+	jsSetterProp<blockSetText, Block>("text"),
+	jsSetterProp<blockSetColor, Block>("color"),
+	jsSetterProp<blockSetPadding, Block>("padding"),
+	jsSetterProp<blockSetVisible, Block>("visible"),
+	jsSetterProp<blockSetGroup, Block>("group"),
+	jsSetterProp<blockSetWidth, Block>("width"),
+	jsSetterProp<blockSetPriority, Block>("priority"),
+	jsSetterProp<blockSetOverflow, Block>("overflow"),
+	jsSetterProp<blockSetSeparator, Block>("separator"),
+	jsSetterProp<blockSetAnimation, Block>("animation"),
+};
+static_assert(std::all_of(std::begin(jsBlockProps), std::end(jsBlockProps),
+		[](const JSSetterProp<Block>& prop) { return prop.arity >= 1 && prop.arity <= WBLOCKS_SET_MAX_ARGS; }));
+static JSAtom jsBlockPropAtoms[std::size(jsBlockProps)];
+
+// `block.set({text, color: [r, g, b], ...})`. Not wrapped, the values are read off the object and converted
+// before taking the lock once for all of them. Nothing is set if one is bad, a setter failing leaves the ones
+// before it set.
+JSValue jsBlockSet(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsObject(argv[0]) || JS_IsArray(ctx, argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	JSPropertyEnum *names;
+	uint32_t count;
+	if (JS_GetOwnPropertyNames(ctx, &names, &count, argv[0], JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY)) {
+		return JS_EXCEPTION;
+	}
+
+	Block *block = getBlockThis(thiz);
+	std::vector<JSBoundSetter> pending;
+	pending.reserve(count);
+	JSValue ret = JS_UNDEFINED;
+	for (uint32_t i = 0; i < count && !JS_IsException(ret); i++) {
+		size_t p = std::find(std::begin(jsBlockPropAtoms), std::end(jsBlockPropAtoms), names[i].atom)
+				- std::begin(jsBlockPropAtoms);
+		if (p == std::size(jsBlockProps)) {
+			const char *name = JS_AtomToCString(ctx, names[i].atom);
+			ret = JS_ThrowTypeError(ctx, "Unknown block property '%s'", name);
+			JS_FreeCString(ctx, name);
+			break;
+		}
+		const JSSetterProp<Block>& prop = jsBlockProps[p];
+		JSValue val = JS_GetProperty(ctx, argv[0], names[i].atom);
+		JSValue args[WBLOCKS_SET_MAX_ARGS];
+		if (prop.arity == 1) {
+			args[0] = JS_DupValue(ctx, val);
+		} else if (!JS_IsArray(ctx, val)) {
+			ret = JS_ThrowTypeError(ctx, "Block property '%s' must be an array of %d", prop.name, prop.arity);
+		} else {
+			for (int a = 0; a < prop.arity; a++) {
+				args[a] = JS_GetPropertyUint32(ctx, val, a);
+			}
+		}
+		if (!JS_IsException(ret)) {
+			ret = prop.bind(ctx, block, prop.arity, args, pending.emplace_back());
+			for (int a = 0; a < prop.arity; a++) {
+				JS_FreeValue(ctx, args[a]);
+			}
+		}
+		JS_FreeValue(ctx, val);
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		JS_FreeAtom(ctx, names[i].atom);
+	}
+	js_free(ctx, names);
+
+	if (!JS_IsException(ret)) {
+		std::lock_guard<std::mutex> lock(barBlocks.mutex);
+		for (JSBoundSetter& set : pending) {
+			ret = set();
+			if (JS_IsException(ret)) {
+				break;
+			}
+		}
+		barBlocks.needsUpdate = true;
+	}
+	return ret;
+}
+
+// Reads `[r, g, b]`, `range` set on failure if the components were numbers but not between 0 and 255
+static bool jsToColor(JSContext *ctx, JSValueConst val, COLORREF *color, bool& range)
+{
+	range = false;
+	if (!JS_IsArray(ctx, val)) {
+		return false;
+	}
+	int rgb[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		JSValue c = JS_GetPropertyUint32(ctx, val, i);
+		const char *error = JSArg<int>::get(ctx, c, rgb[i]);
+		JS_FreeValue(ctx, c);
+		if (error) {
+			return false;
+		}
+	}
+	if (!colorInRange(rgb[0], rgb[1], rgb[2])) {
+		range = true;
+		return false;
+	}
+	*color = RGB(rgb[0], rgb[1], rgb[2]);
+	return true;
+}
+
+// Parses `{text, color: [r, g, b], font, fontSize}`, all but `text` optional. Returns an error or NULL, `range`
+// set if it's a value out of range rather than of the wrong type.
+static const char *jsToSegment(JSContext *ctx, JSValueConst item, const std::shared_ptr<FontRef>& blockFont,
+		TextSegment& seg, bool& range)
+{
+	range = false;
+	JSValue text = JS_GetPropertyStr(ctx, item, "text");
+	JSValue color = JS_GetPropertyStr(ctx, item, "color");
+	JSValue fontName = JS_GetPropertyStr(ctx, item, "font");
+	JSValue fontSize = JS_GetPropertyStr(ctx, item, "fontSize");
+	const char *error = NULL;
+	if (!JS_IsString(text)) {
+		error = "Segment text must be a string";
+	} else if (!JS_IsUndefined(color) && !jsToColor(ctx, color, &seg.color.emplace(), range)) {
+		error = range ? "Segment color components must be between 0 and 255" : "Segment color must be [r, g, b]";
+	} else if ((!JS_IsUndefined(fontName) && !JS_IsString(fontName)) || (!JS_IsUndefined(fontSize) && !JS_IsNumber(fontSize))) {
+		error = "Segment font must be a string and fontSize a number";
+	} else {
+		size_t len;
+		const char *str = JS_ToCStringLen(ctx, &len, text);
+		seg.text = toWide(std::string(str, len));
+		JS_FreeCString(ctx, str);
+
+		// Missing name or size is taken from the block font
+		if (!JS_IsUndefined(fontName) || !JS_IsUndefined(fontSize)) {
+			std::string name = blockFont ? blockFont->name : "";
+			int size = blockFont ? blockFont->size : 0;
+			if (!JS_IsUndefined(fontName)) {
+				const char *nameStr = JS_ToCString(ctx, fontName);
+				name = nameStr;
+				JS_FreeCString(ctx, nameStr);
+			}
+			if (!JS_IsUndefined(fontSize)) {
+				JS_ToInt32(ctx, &size, fontSize);
+			}
+			seg.font = getFont(name, size);
+			if (!seg.font) {
+				error = "Failed to load font";
+			}
+		}
+	}
+	JS_FreeValue(ctx, text);
+	JS_FreeValue(ctx, color);
+	JS_FreeValue(ctx, fontName);
+	JS_FreeValue(ctx, fontSize);
+	return error;
+}
+
+// Not wrapped, the bar numbers are read before taking the lock
+JSValue jsBlockSetBars(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !(JS_IsNull(argv[0]) || JS_IsArray(ctx, argv[0]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	BarMask mask = barMaskAll;
+	if (!JS_IsNull(argv[0])) {
+		mask = 0;
+		uint32_t len;
+		JSValue lenVal = JS_GetPropertyStr(ctx, argv[0], "length");
+		JS_ToUint32(ctx, &len, lenVal);
+		JS_FreeValue(ctx, lenVal);
+		for (uint32_t i = 0; i < len; i++) {
+			JSValue val = JS_GetPropertyUint32(ctx, argv[0], i);
+			int bar;
+			const char *error = JSArg<int>::get(ctx, val, bar);
+			JS_FreeValue(ctx, val);
+			if (error) {
+				return JS_ThrowTypeError(ctx, "%s", error);
+			}
+			if (bar < 0 || bar >= BAR_MAX) {
+				return JS_ThrowRangeError(ctx, "Bar must be 0 to %d", BAR_MAX - 1);
+			}
+			mask |= (BarMask)1 << bar;
+		}
+	}
+
+	auto block = getBlockThis(thiz);
+	barBlocks.mutex.lock();
+	block->bars = mask;
+	block->traceState(TraceOp::Bars);
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+	return JS_UNDEFINED;
+}
+
+// Not wrapped, the segments are converted before taking the lock once
+JSValue jsBlockSetSegments(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsArray(ctx, argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto block = getBlockThis(thiz);
+	uint32_t len;
+	JSValue lenVal = JS_GetPropertyStr(ctx, argv[0], "length");
+	JS_ToUint32(ctx, &len, lenVal);
+	JS_FreeValue(ctx, lenVal);
+	if (len > WBLOCKS_MAX_SEGMENTS) {
+		return JS_ThrowRangeError(ctx, "Segment count must be between 0 and %d", WBLOCKS_MAX_SEGMENTS);
+	}
+
+	std::vector<TextSegment> segments(len);
+	for (uint32_t i = 0; i < len; i++) {
+		JSValue item = JS_GetPropertyUint32(ctx, argv[0], i);
+		bool range;
+		const char *error = jsToSegment(ctx, item, block->blockFont(), segments[i], range);
+		JS_FreeValue(ctx, item);
+		if (error) {
+			return range ? JS_ThrowRangeError(ctx, "%s", error) : JS_ThrowTypeError(ctx, "%s", error);
+		}
+	}
+
+	barBlocks.mutex.lock();
+	block->setSegments(std::move(segments));
+	block->traceState(TraceOp::Segments);
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+	return JS_UNDEFINED;
+}
+
+static void freeBlockHandlers(Block *block)
+{
+	auto it = jsBlockHandlers.find(block);
+	if (it != jsBlockHandlers.end()) {
+		BlockHandlers& handlers = it->second;
+		JS_FreeValue(handlers.ctx, handlers.onClick);
+		JS_FreeValue(handlers.ctx, handlers.onScroll);
+		JS_FreeValue(handlers.ctx, handlers.onHover);
+		jsBlockHandlers.erase(it);
+	}
+	block->interactive = false;
+	block->traceState(TraceOp::Interactive);
+}
+
+static JSValue setBlockHandler(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv,
+		JSValue BlockHandlers::*member)
+{
+	if (argc != 1 || !(JS_IsFunction(ctx, argv[0]) || JS_IsNull(argv[0]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto block = getBlockThis(thiz);
+	BlockHandlers& handlers = jsBlockHandlers[block];
+	handlers.ctx = ctx;
+	handlers.script = currentScript;
+	JS_FreeValue(ctx, handlers.*member);
+	handlers.*member = JS_IsNull(argv[0]) ? JS_UNDEFINED : JS_DupValue(ctx, argv[0]);
+	if (JS_IsUndefined(handlers.onClick) && JS_IsUndefined(handlers.onScroll) && JS_IsUndefined(handlers.onHover)) {
+		freeBlockHandlers(block);
+	} else {
+		block->interactive = true;
+		block->traceState(TraceOp::Interactive);
+	}
+	return JS_UNDEFINED;
+}
+
+JSValue jsBlockOnClick(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return setBlockHandler(ctx, thiz, argc, argv, &BlockHandlers::onClick);
+}
+
+JSValue jsBlockOnScroll(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return setBlockHandler(ctx, thiz, argc, argv, &BlockHandlers::onScroll);
+}
+
+JSValue jsBlockOnHover(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	return setBlockHandler(ctx, thiz, argc, argv, &BlockHandlers::onHover);
+}
+
+// Calls the JS handler for an input event, ran on the JS thread
+void jsBlockEventDispatch(std::vector<void*>& args)
+{
+	assert(args.size() == 1);
+	auto *ev = (BlockEvent*)args[0];
+	auto it = jsBlockHandlers.find(ev->block);
+	if (it != jsBlockHandlers.end()) {
+		BlockHandlers& handlers = it->second;
+		JSContext *ctx = handlers.ctx;
+		JSValue fn = JS_UNDEFINED;
+		JSValue fnArgs[2];
+		int fnArgc = 0;
+		if (ev->type == BlockEventType::Click) {
+			static const char *buttons[] = { "left", "middle", "right" };
+			fn = handlers.onClick;
+			fnArgs[fnArgc++] = JS_NewString(ctx, buttons[ev->value]);
+			fnArgs[fnArgc++] = JS_NewInt32(ctx, ev->x);
+		} else if (ev->type == BlockEventType::Scroll) {
+			fn = handlers.onScroll;
+			fnArgs[fnArgc++] = JS_NewFloat64(ctx, ev->value / (double)WHEEL_DELTA);
+		} else if (ev->type == BlockEventType::Hover) {
+			fn = handlers.onHover;
+			fnArgs[fnArgc++] = JS_NewBool(ctx, ev->value);
+		}
+		if (!JS_IsUndefined(fn) && !scriptDisabled(handlers.script)) {
+			stats.inputLatency.record(nowUs() - ev->queuedAt);
+			uint32_t prevScript = enterScript(handlers.script);
+			fn = JS_DupValue(ctx, fn); // The handler may replace itself
+			JSValue ret = JS_Call(ctx, fn, JS_UNDEFINED, fnArgc, fnArgs);
+			if (JS_IsException(ret)) {
+				js_std_dump_error(ctx);
+			}
+			JS_FreeValue(ctx, ret);
+			JS_FreeValue(ctx, fn);
+			jsRunPendingJobs(ctx);
+			enterScript(prevScript);
+		}
+		for (int i = 0; i < fnArgc; i++) {
+			JS_FreeValue(ctx, fnArgs[i]);
+		}
+	}
+	delete ev;
+}
+
+// Keeps the graph alive for as long as JS holds on to its sample buffer
+void jsGraphBufferFree(JSRuntime *rt, void *opaque, void *ptr)
+{
+	delete (std::shared_ptr<Graph>*)opaque;
+}
+
+// Takes `{columns, min, max, height}` or null, returns a Float32Array over the sample ring. Not wrapped, the
+// options are read and the array made before taking the lock to swap the graph in.
+JSValue jsBlockSetGraph(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !(JS_IsObject(argv[0]) || JS_IsNull(argv[0]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto block = getBlockThis(thiz);
+	std::shared_ptr<Graph> graph;
+	double height = 0;
+	JSValue arr = JS_UNDEFINED;
+	if (!JS_IsNull(argv[0])) {
+		double columns = jsGetNumberProp(ctx, argv[0], "columns", 60);
+		if (!(columns >= 1 && columns <= 4096)) {
+			return JS_ThrowRangeError(ctx, "Graph columns must be between 1 and 4096");
+		}
+		height = jsGetNumberProp(ctx, argv[0], "height", 0);
+		if (!(height >= 0 && height <= GRAPH_MAX_HEIGHT)) {
+			return JS_ThrowRangeError(ctx, "Graph height must be between 0 and %d", GRAPH_MAX_HEIGHT);
+		}
+		double min = jsGetNumberProp(ctx, argv[0], "min", 0);
+		double max = jsGetNumberProp(ctx, argv[0], "max", 100);
+		graph = std::make_shared<Graph>(columns, min, max);
+
+		JSValue buf = JS_NewArrayBuffer(ctx, (uint8_t*)graph->data(), graph->columns() * sizeof(float),
+				jsGraphBufferFree, new std::shared_ptr<Graph>(graph), false);
+		JSValue global = JS_GetGlobalObject(ctx);
+		JSValue ctor = JS_GetPropertyStr(ctx, global, "Float32Array");
+		arr = JS_CallConstructor(ctx, ctor, 1, &buf);
+		JS_FreeValue(ctx, ctor);
+		JS_FreeValue(ctx, global);
+		JS_FreeValue(ctx, buf);
+		if (JS_IsException(arr)) {
+			return arr;
+		}
+	}
+
+	barBlocks.mutex.lock();
+	block->graph = std::move(graph);
+	block->graphHeight = height;
+	block->traceState(TraceOp::Graph);
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+	return arr;
+}
+
+// Appends samples, returning the head index
+JSValue jsBlockPushSamples(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	auto block = getBlockThis(thiz);
+	if (!block->graph) {
+		return JS_ThrowReferenceError(ctx, "Block has no graph");
+	}
+	size_t from = block->graph->commit(0);
+	for (int i = 0; i < argc; i++) {
+		double value;
+		if (!JS_IsNumber(argv[i]) || JS_ToFloat64(ctx, &value, argv[i])) {
+			block->traceSamples(from, i);
+			return JS_ThrowTypeError(ctx, "Invalid argument");
+		}
+		block->graph->push(value);
+	}
+	block->traceSamples(from, argc);
+	return JS_NewInt32(ctx, block->graph->commit(0));
+}
+
+// Commits samples written to the buffer from `setGraph` starting at the head, returning the new head. Only
+// committed samples are drawn, the buffer itself is never read by the UI thread.
+JSValue jsBlockCommitSamples(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsNumber(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto block = getBlockThis(thiz);
+	if (!block->graph) {
+		return JS_ThrowReferenceError(ctx, "Block has no graph");
+	}
+	int n = 0;
+	JSArg<int>::get(ctx, argv[0], n);
+	if (n < 0 || (size_t)n > block->graph->columns()) {
+		return JS_ThrowRangeError(ctx, "Sample count must be between 0 and the graph columns");
+	}
+	size_t from = block->graph->commit(0), head = block->graph->commit(n);
+	block->traceSamples(from, n);
+	return JS_NewInt32(ctx, head);
+}
+
+IWICImagingFactory *wicFactory; // Only used on the JS thread
+
+// Decodes the frame closest to `size` pixels high and scales it to that height, 0 keeps the original size
+std::shared_ptr<Image> decodeImage(const std::string& path, int size)
+{
+	IWICBitmapDecoder *decoder = NULL;
+	if (FAILED(wicFactory->CreateDecoderFromFilename(toWide(path).c_str(), NULL, GENERIC_READ,
+			WICDecodeMetadataCacheOnDemand, &decoder))) {
+		return nullptr;
+	}
+
+	// Icons hold several frames, prefer the smallest one that doesn't need upscaling
+	UINT frameCount = 0, best = 0, bestW = 0, bestH = 0;
+	decoder->GetFrameCount(&frameCount);
+	for (UINT i = 0; i < frameCount; i++) {
+		IWICBitmapFrameDecode *frame;
+		UINT w, h;
+		if (FAILED(decoder->GetFrame(i, &frame))) {
+			continue;
+		}
+		frame->GetSize(&w, &h);
+		frame->Release();
+		bool fits = (int)h >= size, bestFits = (int)bestH >= size;
+		if (!bestH || (fits && (!bestFits || h < bestH)) || (!fits && !bestFits && h > bestH)) {
+			best = i;
+			bestW = w;
+			bestH = h;
+		}
+	}
+
+	std::shared_ptr<Image> image;
+	IWICBitmapFrameDecode *frame = NULL;
+	IWICBitmapScaler *scaler = NULL;
+	IWICFormatConverter *converter = NULL;
+	if (bestH && SUCCEEDED(decoder->GetFrame(best, &frame))) {
+		IWICBitmapSource *source = frame;
+		UINT w = bestW, h = bestH;
+		if (size > 0 && (int)h != size) {
+			// Saturated, so a very wide image fails the size check below rather than wrapping
+			w = (UINT)std::clamp((uint64_t)bestW * size / bestH, (uint64_t)1, (uint64_t)WBLOCKS_IMAGE_MAX_SIDE + 1);
+			h = size;
+			if (SUCCEEDED(wicFactory->CreateBitmapScaler(&scaler))
+					&& SUCCEEDED(scaler->Initialize(source, w, h, WICBitmapInterpolationModeFant))) {
+				source = scaler;
+			} else {
+				w = bestW;
+				h = bestH;
+			}
+		}
+		// Counted in size_t, CopyPixels takes the byte count as a UINT
+		size_t bytes = (size_t)w * h * 4;
+		bool fits = w <= WBLOCKS_IMAGE_MAX_SIDE && h <= WBLOCKS_IMAGE_MAX_SIDE && bytes <= UINT_MAX;
+		if (fits && SUCCEEDED(wicFactory->CreateFormatConverter(&converter))
+				&& SUCCEEDED(converter->Initialize(source, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone,
+						NULL, 0, WICBitmapPaletteTypeCustom))) {
+			image = std::make_shared<Image>();
+			image->width = w;
+			image->height = h;
+			image->pixels.resize((size_t)w * h);
+			if (FAILED(converter->CopyPixels(NULL, w * 4, (UINT)bytes, (BYTE*)image->pixels.data()))) {
+				image = nullptr;
+			}
+		}
+	}
+	if (converter) {
+		converter->Release();
+	}
+	if (scaler) {
+		scaler->Release();
+	}
+	if (frame) {
+		frame->Release();
+	}
+	decoder->Release();
+	return image;
+}
+
+ImageCache imageCache(WBLOCKS_IMAGE_CACHE_BYTES, decodeImage); // Only used on the JS thread
+
+void jsImageFinalizer(JSRuntime *rt, JSValue val)
+{
+	delete (std::shared_ptr<Image>*)JS_GetOpaque(val, jsImageClassId);
+}
+
+// Gets an image from a path and optional height, or from an `Image`, returns null with an exception set on failure
+std::shared_ptr<Image> jsToImage(JSContext *ctx, int argc, JSValueConst *argv)
+{
+	auto handle = (std::shared_ptr<Image>*)JS_GetOpaque(argv[0], jsImageClassId);
+	if (handle) {
+		return *handle;
+	}
+	double size = 0;
+	if (!JS_IsString(argv[0]) || (argc >= 2 && JSArg<double>::get(ctx, argv[1], size))) {
+		JS_ThrowTypeError(ctx, "Invalid argument");
+		return nullptr;
+	}
+	if (!(size >= 0 && size <= WBLOCKS_IMAGE_MAX_HEIGHT)) {
+		JS_ThrowRangeError(ctx, "Image height must be between 0 and %d", WBLOCKS_IMAGE_MAX_HEIGHT);
+		return nullptr;
+	}
+	const char *path = JS_ToCString(ctx, argv[0]);
+	auto image = imageCache.get(path, (int)size);
+	if (!image) {
+		JS_ThrowReferenceError(ctx, "Failed to load image '%s'", path);
+	}
+	JS_FreeCString(ctx, path);
+	return image;
+}
+
+// Returns an `Image` handle, so switching a block between images never touches the cache
+JSValue jsLoadImage(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc < 1) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto image = jsToImage(ctx, argc, argv);
+	if (!image) {
+		return JS_EXCEPTION;
+	}
+	JSValue obj = JS_NewObjectClass(ctx, jsImageClassId);
+	JS_SetOpaque(obj, new std::shared_ptr<Image>(image));
+	JS_SetPropertyStr(ctx, obj, "width", JS_NewInt32(ctx, image->width));
+	JS_SetPropertyStr(ctx, obj, "height", JS_NewInt32(ctx, image->height));
+	return obj;
+}
+
+// Takes an `Image`, a path and optional height, or null. Decodes before locking the bar.
+JSValue jsBlockSetImage(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc < 1) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	std::shared_ptr<Image> image;
+	if (!JS_IsNull(argv[0])) {
+		image = jsToImage(ctx, argc, argv);
+		if (!image) {
+			return JS_EXCEPTION;
+		}
+	}
+	auto block = getBlockThis(thiz);
+	barBlocks.mutex.lock();
+	block->image = std::move(image);
+	block->traceState(TraceOp::Image);
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+	return JS_UNDEFINED;
+}
+
+JSValue jsBlockClone(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	bool keepVisibility = false;
+	if (argc >= 1) {
+		if (!JS_IsBool(argv[0])) {
+			return JS_ThrowTypeError(ctx, "Invalid argument");
+		}
+		keepVisibility = JS_VALUE_GET_BOOL(argv[0]);
+	}
+	JSValue jsBlock = createJSBlockFromSrc(ctx, getBlockThis(thiz));
+	if (!keepVisibility) {
+		getBlockThis(jsBlock)->visible = true;
+		getBlockThis(jsBlock)->traceState(TraceOp::Visible);
+	}
+	return jsBlock;
+}
+
+JSValue jsBlockRemove(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	auto block = getBlockThis(thiz);
+	if (!std::count(barBlocks.blocks.begin(), barBlocks.blocks.end(), block)) {
+		return JS_ThrowReferenceError(ctx, "Non-existent block");
+	}
+	barBlocks.blocks.erase(std::remove(barBlocks.blocks.begin(), barBlocks.blocks.end(), block), barBlocks.blocks.end());
+	std::erase_if(barBlocks.named, [&](const auto& entry) { return entry.second == block; });
+	freeBlockHandlers(block);
+	trace(TraceOp::Remove, block->traceId);
+	return JS_UNDEFINED;
+}
+
+// Takes a block made by IPC pushes off the bar, barBlocks.mutex must be held. It's deleted by the next layout,
+// the last one may still point at it.
+static void dropPushedBlock(Block *block)
+{
+	barBlocks.pushed.erase(block);
+	barBlocks.blocks.erase(std::remove(barBlocks.blocks.begin(), barBlocks.blocks.end(), block), barBlocks.blocks.end());
+	trace(TraceOp::Remove, block->traceId);
+	barBlocks.retired.push_back(block);
+	barBlocks.needsUpdate = true;
+}
+
+// Makes IPC pushes to `name` go to the block, barBlocks.mutex must be held
+void nameBlock(Block *block, const std::string& name)
+{
+	// A block that pushes made up before the script got to it gives way
+	Block *&named = barBlocks.named[name];
+	if (named && barBlocks.pushed.count(named)) {
+		dropPushedBlock(named);
+	}
+	named = block;
+}
+
+JSValue jsBlockSetName(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !(JS_IsString(argv[0]) || JS_IsNull(argv[0]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto block = getBlockThis(thiz);
+	std::erase_if(barBlocks.named, [&](const auto& entry) { return entry.second == block; });
+	if (JS_IsNull(argv[0])) {
+		return JS_UNDEFINED;
+	}
+	size_t len;
+	const char *str = JS_ToCStringLen(ctx, &len, argv[0]);
+	std::string name(str, len);
+	JS_FreeCString(ctx, str);
+	if (name.empty() || name.size() > 255) {
+		return JS_ThrowRangeError(ctx, "Name must be 1 to 255 bytes");
+	}
+	nameBlock(block, name);
+	return JS_UNDEFINED;
+}
+
+NativeScheduler *nativeScheduler; // Created with the first `.block`
+
+// Ran on a native block worker
+void applyNativeBlock(void *target, const std::string& text, std::optional<uint32_t> color)
+{
+	auto block = (Block*)target;
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	block->setText(text);
+	block->traceState(TraceOp::Text);
+	if (color) {
+		block->color = *color;
+		block->traceState(TraceOp::Color);
+	}
+	barBlocks.needsUpdate = true;
+}
+
+JSValue jsLoadNativeBlock(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc != 1 || !JS_IsString(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	size_t len;
+	const char *src = JS_ToCStringLen(ctx, &len, argv[0]);
+	NativeBlockDef def;
+	std::string parseErr;
+	bool ok = parseNativeBlock(std::string_view(src, len), def, parseErr);
+	JS_FreeCString(ctx, src);
+	if (!ok) {
+		return JS_ThrowSyntaxError(ctx, "%s", parseErr.c_str());
+	}
+
+	barBlocks.mutex.lock();
+	Block *block = newBlock(barBlocks.defaultBlock);
+	if (def.group) {
+		block->group = *def.group;
+		block->traceState(TraceOp::Group);
+	}
+	if (!def.name.empty()) {
+		nameBlock(block, def.name);
+	}
+	barBlocks.needsUpdate = true;
+	barBlocks.mutex.unlock();
+
+	if (!nativeScheduler) {
+		nativeScheduler = new NativeScheduler(WBLOCKS_NATIVE_BLOCK_THREADS, applyNativeBlock, &power);
+	}
+	nativeScheduler->add(std::move(def), block);
+	return JS_UNDEFINED;
+}
+
+// Builds JS values from a parsed tree, creating each interned key's atom once
+struct JsonMaterializer {
+	JSContext *ctx;
+	const JsonDoc& doc;
+	std::unordered_map<uint32_t, JSAtom> atoms; // By string offset
+
+	~JsonMaterializer() {
+		for (auto& [offset, atom] : atoms) {
+			JS_FreeAtom(ctx, atom);
+		}
+	}
+
+	JSAtom atom(const JsonNode& key) {
+		auto [it, created] = atoms.try_emplace(key.value, JS_ATOM_NULL);
+		if (created) {
+			std::string_view name = doc.string(key);
+			it->second = JS_NewAtomLen(ctx, name.data(), name.size());
+		}
+		return it->second;
+	}
+
+	JSValue value(uint32_t i) {
+		const JsonNode& node = doc.node(i);
+		switch (node.type) {
+		case JsonType::Null: return JS_NULL;
+		case JsonType::False: return JS_FALSE;
+		case JsonType::True: return JS_TRUE;
+		case JsonType::Number: {
+			// Small integers as ints, like JSON.parse. Range checked before converting, -0 stays a double.
+			double num = doc.number(node);
+			bool isInt = num >= INT32_MIN && num <= INT32_MAX && num == (int32_t)num
+					&& !(num == 0 && std::signbit(num));
+			return isInt ? JS_NewInt32(ctx, num) : JS_NewFloat64(ctx, num);
+		}
+		case JsonType::String: {
+			std::string_view str = doc.string(node);
+			return JS_NewStringLen(ctx, str.data(), str.size());
+		}
+		case JsonType::Array: {
+			JSValue arr = JS_NewArray(ctx);
+			uint32_t child = i + 1;
+			for (uint32_t k = 0; k < node.size && !JS_IsException(arr); k++) {
+				JSValue val = value(child);
+				if (JS_IsException(val) || JS_DefinePropertyValueUint32(ctx, arr, k, val, JS_PROP_C_W_E) < 0) {
+					JS_FreeValue(ctx, arr);
+					arr = JS_EXCEPTION;
+				}
+				child = doc.node(child).next;
+			}
+			return arr;
+		}
+		case JsonType::Object: {
+			JSValue obj = JS_NewObject(ctx);
+			uint32_t child = i + 1;
+			for (uint32_t k = 0; k < node.size && !JS_IsException(obj); k++) {
+				JSValue val = value(child + 1);
+				if (JS_IsException(val) || JS_DefinePropertyValue(ctx, obj, atom(doc.node(child)), val, JS_PROP_C_W_E) < 0) {
+					JS_FreeValue(ctx, obj);
+					obj = JS_EXCEPTION;
+				}
+				child = doc.node(child + 1).next;
+			}
+			return obj;
+		}
+		}
+		return JS_UNDEFINED;
+	}
+};
+
+void jsFreeShellOutput(JSRuntime *rt, void *opaque, void *ptr)
+{
+	free(ptr);
+}
+
+// Turns what the command produced into the value the Promise settles with
+JSValue jsShellResult(js_shell_thread_data *td)
+{
+	JSContext *ctx = td->ctx;
+	if (!td->success) {
+		return JS_NewStringLen(ctx, td->error.data(), td->error.size());
+	}
+	if (td->mode == ShellMode::Text) {
+		return JS_NewStringLen(ctx, (const char*)td->output.data, td->output.len);
+	}
+	if (td->mode == ShellMode::Bytes) {
+		size_t len = td->output.len;
+		uint8_t *data = td->output.release();
+		if (!data) {
+			return JS_NewArrayBufferCopy(ctx, NULL, 0);
+		}
+		return JS_NewArrayBuffer(ctx, data, len, jsFreeShellOutput, NULL, false);
+	}
+
+	uint64_t start = nowUs();
+	JsonMaterializer json{ .ctx = ctx, .doc = td->json };
+	JSValue result;
+	if (td->paths.empty()) {
+		result = json.value(0);
+	} else {
+		result = td->pathList ? JS_NewArray(ctx) : JS_UNDEFINED;
+		for (uint32_t i = 0; i < td->paths.size(); i++) {
+			uint32_t node = td->json.select(td->paths[i]);
+			JSValue val = node == JSON_MISSING ? JS_UNDEFINED : json.value(node);
+			if (!td->pathList) {
+				result = val;
+			} else if (JS_IsException(val) || JS_DefinePropertyValueUint32(ctx, result, i, val, JS_PROP_C_W_E) < 0) {
+				JS_FreeValue(ctx, result);
+				result = JS_EXCEPTION;
+				break;
+			}
+		}
+	}
+	stats.jsonMaterialize.record(nowUs() - start);
+	if (JS_IsException(result)) {
+		td->success = false;
+		return JS_GetException(ctx);
+	}
+	return result;
 }
 
-template<JSCFunction *fn>
-JSValue jsWrapBlockFn(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+std::unordered_map<uint32_t, js_shell_thread_data*> jsShellRunning; // By id, only used on the JS thread
+uint32_t jsShellNextId;
+
+// The resolver for `jsShell` which resolves the Promise, ran on the JS thread
+void jsShellResolve(std::vector<void*>& args)
 {
 #ifdef DEBUG
-	printf("FN %lld\n", (size_t)fn);
+	printf("jsShellResolve\n");
 #endif
-	barBlocks.mutex.lock();
-	JSValue ret = fn(ctx, thiz, argc, argv);
-	barBlocks.needsUpdate = true;
-	barBlocks.mutex.unlock();
-	return ret;
+	assert(args.size() == 1);
+	auto *td = (js_shell_thread_data*)args[0];
+	uint64_t start = nowUs();
+	if (!scriptDisabled(td->script)) {
+		uint32_t prevScript = enterScript(td->script);
+		JSValue val = jsShellResult(td);
+		JSValue resp = JS_Call(td->ctx, td->success ? td->resolveFn : td->rejectFn, JS_UNDEFINED, 1, &val);
+		JS_FreeValue(td->ctx, resp);
+		JS_FreeValue(td->ctx, val);
+		jsRunPendingJobs(td->ctx); // Continuations of `await $(...)`
+		enterScript(prevScript);
+	}
+	stats.shellResolve.record(nowUs() - start);
+	trace(TraceOp::ShellResolve, td->id, {(int64_t)(nowUs() - start)});
+	JS_FreeValue(td->ctx, td->resolveFn);
+	JS_FreeValue(td->ctx, td->rejectFn);
+	if (!JS_IsUndefined(td->signal)) {
+		JSValue remove = JS_GetPropertyStr(td->ctx, td->signal, "removeEventListener");
+		JSValue removeArgs[] = { JS_NewString(td->ctx, "abort"), td->abortListener };
+		JS_FreeValue(td->ctx, JS_Call(td->ctx, remove, td->signal, 2, removeArgs));
+		JS_FreeValue(td->ctx, removeArgs[0]);
+		JS_FreeValue(td->ctx, remove);
+		JS_FreeValue(td->ctx, td->abortListener);
+		JS_FreeValue(td->ctx, td->signal);
+	}
+	jsShellRunning.erase(td->id);
+	td->thread.detach();
+	delete td;
 }
 
-// Used to run events that need to be ran on the JS thread
-JSValue jsYieldToC(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// The command runner for `jsShell`, ran on a different thread
+void jsShellThread(js_shell_thread_data *td)
 {
-	jsThreadQueueMutex.lock();
-	for (auto& item : jsThreadQueue) {
-		item.first(item.second);
+#ifdef DEBUG
+	printf("jsShellThread\n");
+#endif
+	ProcessEnd end = td->process.run(td->cmd, td->options, td->output);
+	trace(TraceOp::ShellExit, td->id, {(int)end, (int64_t)td->output.len});
+	const char *error = processEndError(end);
+	td->success = !error;
+	if (error) {
+		td->error = error;
+	}
+	if (td->success && td->mode == ShellMode::Json) {
+		uint64_t start = nowUs();
+		std::string error;
+		if (!td->json.parse((const char*)td->output.data, td->output.len, error)) {
+			td->success = false;
+			td->error = "Invalid JSON: " + error;
+		}
+		free(td->output.release());
+		stats.jsonParse.record(nowUs() - start);
 	}
-	jsThreadQueue.clear();
+	jsThreadQueueMutex.lock();
+	jsThreadQueue.push_back(std::make_pair(jsShellResolve, std::vector({(void*)td})));
 	jsThreadQueueMutex.unlock();
-	return JS_UNDEFINED;
 }
 
-JSValue createJSBlockFromSrc(JSContext *ctx, Block *srcBlock)
+// Listener added to a `signal`, ran on the JS thread
+JSValue jsShellAbort(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv, int magic, JSValue *data)
 {
-	Block *block = new Block(*srcBlock);
-	JSValue obj = JS_NewObjectClass(ctx, jsBlockClassId);
-	JS_SetOpaque(obj, block);
-	barBlocks.blocks.push_back(block);
-	return obj;
+	auto it = jsShellRunning.find(JS_VALUE_GET_INT(data[0]));
+	if (it != jsShellRunning.end()) {
+		it->second->process.kill(ProcessEnd::Cancelled);
+	}
+	return JS_UNDEFINED;
 }
 
-JSValue jsCreateBlock(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Reads the command and its `{timeout, maxOutput, truncate, signal}` options, returns null with an exception set if invalid
+js_shell_thread_data *jsNewShellData(JSContext *ctx, ShellMode mode, JSValueConst cmd, JSValueConst options)
 {
-	return createJSBlockFromSrc(ctx, &barBlocks.defaultBlock);
+	if (!JS_IsString(cmd) || !(JS_IsUndefined(options) || JS_IsObject(options))) {
+		JS_ThrowTypeError(ctx, "Invalid argument");
+		return NULL;
+	}
+	auto td = new js_shell_thread_data();
+	const char *str = JS_ToCString(ctx, cmd);
+	td->cmd = str;
+	JS_FreeCString(ctx, str);
+	td->mode = mode;
+	if (JS_IsObject(options)) {
+		td->options.timeoutMs = jsClampUnsigned<uint32_t>(jsGetNumberProp(ctx, options, "timeout", 0));
+		td->options.maxOutput = jsClampUnsigned<size_t>(jsGetNumberProp(ctx, options, "maxOutput", 0));
+		JSValue truncate = JS_GetPropertyStr(ctx, options, "truncate");
+		td->options.truncate = JS_ToBool(ctx, truncate) > 0;
+		JS_FreeValue(ctx, truncate);
+		JSValue signal = JS_GetPropertyStr(ctx, options, "signal");
+		if (JS_IsObject(signal)) {
+			td->signal = signal;
+		} else {
+			JS_FreeValue(ctx, signal);
+		}
+	}
+	return td;
 }
 
-static inline Block *getBlockThis(JSValueConst thiz)
+// Starts `td` on its own thread, returning a Promise settled from `jsShellResolve`
+JSValue jsShellStart(JSContext *ctx, js_shell_thread_data *td)
 {
-	return (Block*)JS_GetOpaque(thiz, jsBlockClassId);
+	JSValue resolvingFns[2];
+	JSValue promise = JS_NewPromiseCapability(ctx, resolvingFns);
+	if (JS_IsException(promise)) {
+		JS_FreeValue(ctx, td->signal);
+		delete td;
+		return promise;
+	}
+	td->resolveFn = resolvingFns[0];
+	td->rejectFn = resolvingFns[1];
+	td->ctx = ctx;
+	td->script = currentScript;
+	td->id = jsShellNextId++;
+	jsShellRunning[td->id] = td;
+
+	// Listen for the signal to kill the command, it won't even start if already aborted
+	if (!JS_IsUndefined(td->signal)) {
+		JSValue aborted = JS_GetPropertyStr(ctx, td->signal, "aborted");
+		if (JS_ToBool(ctx, aborted) > 0) {
+			td->process.kill(ProcessEnd::Cancelled);
+		}
+		JS_FreeValue(ctx, aborted);
+		JSValue id = JS_NewInt32(ctx, td->id);
+		td->abortListener = JS_NewCFunctionData(ctx, jsShellAbort, 0, 0, 1, &id);
+		JSValue add = JS_GetPropertyStr(ctx, td->signal, "addEventListener");
+		JSValue addArgs[] = { JS_NewString(ctx, "abort"), td->abortListener };
+		JS_FreeValue(ctx, JS_Call(ctx, add, td->signal, 2, addArgs));
+		JS_FreeValue(ctx, addArgs[0]);
+		JS_FreeValue(ctx, add);
+	}
+	trace(TraceOp::ShellStart, td->id, {}, td->cmd);
+	td->thread = std::thread(jsShellThread, td);
+	return promise;
 }
 
-JSValue jsBlockSetFont(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Function the user calls from `$`
+JSValue jsShell(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	// TODO: make size an optional parameter, retaining size if not given
-	if (argc != 2 || !JS_IsString(argv[0]) || !JS_IsNumber(argv[1])) {
+	// TODO: make this a tag template function instead...?
+	if (argc < 1) {
 		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	const char *fontName = JS_ToCString(ctx, argv[0]);
-	bool ok = getBlockThis(thiz)->setFont(fontName, JS_VALUE_GET_INT(argv[1]));
-	JS_FreeCString(ctx, fontName);
-	return ok ? JS_UNDEFINED : JS_ThrowInternalError(ctx, "Failed to load font");
+	auto td = jsNewShellData(ctx, ShellMode::Text, argv[0], argc >= 2 ? argv[1] : JS_UNDEFINED);
+	return td ? jsShellStart(ctx, td) : JS_EXCEPTION;
 }
 
-JSValue jsBlockSetText(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Function the user calls from `$bytes`, resolving to an ArrayBuffer that owns the output
+JSValue jsShellBytes(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	if (argc != 1 || !JS_IsString(argv[0])) {
+	if (argc < 1) {
 		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	size_t len;
-	const char *str = JS_ToCStringLen(ctx, &len, argv[0]);
-	getBlockThis(thiz)->setText(std::string(str, len));
-	JS_FreeCString(ctx, str);
-	return JS_UNDEFINED;
+	auto td = jsNewShellData(ctx, ShellMode::Bytes, argv[0], argc >= 2 ? argv[1] : JS_UNDEFINED);
+	return td ? jsShellStart(ctx, td) : JS_EXCEPTION;
 }
 
-JSValue jsBlockSetColor(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Function the user calls from `$json`, with an optional path or array of paths to select before the options
+JSValue jsShellJson(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	if (argc != 3 || !JS_IsNumber(argv[0]) || !JS_IsNumber(argv[1]) || !JS_IsNumber(argv[2])) {
+	if (argc < 1 || !JS_IsString(argv[0])) {
 		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	getBlockThis(thiz)->color = JS_VALUE_GET_INT(argv[0])
-		| (JS_VALUE_GET_INT(argv[1]) << 8)
-		| (JS_VALUE_GET_INT(argv[2]) << 16);
-	return JS_UNDEFINED;
+	std::vector<std::string> paths;
+	bool pathList = argc >= 2 && JS_IsArray(ctx, argv[1]);
+	if (pathList) {
+		uint32_t len;
+		JSValue lenVal = JS_GetPropertyStr(ctx, argv[1], "length");
+		JS_ToUint32(ctx, &len, lenVal);
+		JS_FreeValue(ctx, lenVal);
+		for (uint32_t i = 0; i < len; i++) {
+			JSValue item = JS_GetPropertyUint32(ctx, argv[1], i);
+			const char *path = JS_IsString(item) ? JS_ToCString(ctx, item) : NULL;
+			JS_FreeValue(ctx, item);
+			if (!path) {
+				return JS_ThrowTypeError(ctx, "Invalid argument");
+			}
+			paths.push_back(path);
+			JS_FreeCString(ctx, path);
+		}
+	} else if (argc >= 2 && !JS_IsUndefined(argv[1])) {
+		if (!JS_IsString(argv[1])) {
+			return JS_ThrowTypeError(ctx, "Invalid argument");
+		}
+		const char *path = JS_ToCString(ctx, argv[1]);
+		paths.push_back(path);
+		JS_FreeCString(ctx, path);
+	}
+
+	auto td = jsNewShellData(ctx, ShellMode::Json, argv[0], argc >= 3 ? argv[2] : JS_UNDEFINED);
+	if (!td) {
+		return JS_EXCEPTION;
+	}
+	td->paths = std::move(paths);
+	td->pathList = pathList;
+	return jsShellStart(ctx, td);
+}
+
+WorkerPool *ioPool; // Created with the JS runtime
+
+enum class FileOp { Read, Stat, Tail };
+
+struct js_file_job_data {
+	JSValue resolveFn, rejectFn;
+	JSContext *ctx;
+	uint32_t script;
+	FileOp op;
+	std::string path;
+	bool binary, map;
+	int lines;
+
+	bool success;
+	std::string error;
+	FileBuffer buf;
+	FileStat st;
+	std::string text;
+};
+
+void jsFreeFileBuffer(JSRuntime *rt, void *opaque, void *ptr)
+{
+	auto buf = (FileBuffer*)opaque;
+	fileRelease(*buf);
+	delete buf;
 }
 
-JSValue jsBlockSetPadding(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+JSValue jsFileResult(js_file_job_data *job)
 {
-	if (argc != 2 || !JS_IsNumber(argv[0]) || !JS_IsNumber(argv[1])) {
-		return JS_ThrowTypeError(ctx, "Invalid argument");
+	JSContext *ctx = job->ctx;
+	if (!job->success) {
+		return JS_NewStringLen(ctx, job->error.data(), job->error.size());
 	}
-	auto block = getBlockThis(thiz);
-	block->padLeft = JS_VALUE_GET_INT(argv[0]);
-	block->padRight = JS_VALUE_GET_INT(argv[1]);
-	return JS_UNDEFINED;
+	if (job->op == FileOp::Read && job->binary) {
+		auto buf = new FileBuffer(job->buf);
+		job->buf = FileBuffer();
+		return JS_NewArrayBuffer(ctx, buf->data, buf->len, jsFreeFileBuffer, buf, false);
+	}
+	if (job->op == FileOp::Read) {
+		return JS_NewStringLen(ctx, (const char*)job->buf.data, job->buf.len);
+	}
+	if (job->op == FileOp::Stat) {
+		JSValue obj = JS_NewObject(ctx);
+		JS_SetPropertyStr(ctx, obj, "size", JS_NewInt64(ctx, job->st.size));
+		JS_SetPropertyStr(ctx, obj, "mtime", JS_NewInt64(ctx, job->st.mtimeMs));
+		JS_SetPropertyStr(ctx, obj, "isFile", JS_NewBool(ctx, job->st.isFile));
+		JS_SetPropertyStr(ctx, obj, "isDirectory", JS_NewBool(ctx, job->st.isDirectory));
+		return obj;
+	}
+	return JS_NewStringLen(ctx, job->text.data(), job->text.size());
 }
 
-JSValue jsBlockSetVisible(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Settles the Promise of a file job, ran on the JS thread
+void jsFileResolve(std::vector<void*>& args)
 {
-	if (argc != 1 || !JS_IsBool(argv[0])) {
-		return JS_ThrowTypeError(ctx, "Invalid argument");
+	assert(args.size() == 1);
+	auto *job = (js_file_job_data*)args[0];
+	JSContext *ctx = job->ctx;
+	if (!scriptDisabled(job->script)) {
+		uint32_t prevScript = enterScript(job->script);
+		JSValue val = jsFileResult(job);
+		JSValue resp = JS_Call(ctx, job->success ? job->resolveFn : job->rejectFn, JS_UNDEFINED, 1, &val);
+		JS_FreeValue(ctx, resp);
+		JS_FreeValue(ctx, val);
+		jsRunPendingJobs(ctx);
+		enterScript(prevScript);
 	}
-	getBlockThis(thiz)->visible = JS_VALUE_GET_BOOL(argv[0]);
-	return JS_UNDEFINED;
+	JS_FreeValue(ctx, job->resolveFn);
+	JS_FreeValue(ctx, job->rejectFn);
+	fileRelease(job->buf);
+	delete job;
 }
 
-JSValue jsBlockClone(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Runs the job on the I/O pool, returning a Promise settled from `jsFileResolve`
+JSValue jsFileStart(JSContext *ctx, js_file_job_data *job)
 {
-	bool keepVisibility = false;
-	if (argc >= 1) {
-		if (!JS_IsBool(argv[0])) {
-			return JS_ThrowTypeError(ctx, "Invalid argument");
-		}
-		keepVisibility = JS_VALUE_GET_BOOL(argv[0]);
+	JSValue resolvingFns[2];
+	JSValue promise = JS_NewPromiseCapability(ctx, resolvingFns);
+	if (JS_IsException(promise)) {
+		delete job;
+		return promise;
 	}
-	JSValue jsBlock = createJSBlockFromSrc(ctx, getBlockThis(thiz));
-	if (!keepVisibility) {
-		getBlockThis(jsBlock)->visible = true;
+	job->resolveFn = resolvingFns[0];
+	job->rejectFn = resolvingFns[1];
+	job->ctx = ctx;
+	job->script = currentScript;
+	ioPool->submit([job] {
+		if (job->op == FileOp::Read) {
+			job->success = fileRead(job->path, job->map, job->buf, job->error);
+		} else if (job->op == FileOp::Stat) {
+			job->success = fileStat(job->path, job->st, job->error);
+		} else {
+			job->success = fileTail(job->path, job->lines, WBLOCKS_TAIL_MAX_BYTES, job->text, job->error);
+		}
+		jsThreadQueueMutex.lock();
+		jsThreadQueue.push_back(std::make_pair(jsFileResolve, std::vector({(void*)job})));
+		jsThreadQueueMutex.unlock();
+	});
+	return promise;
+}
+
+// Returns null with an exception set if `path` isn't a string
+js_file_job_data *jsNewFileJob(JSContext *ctx, FileOp op, JSValueConst path)
+{
+	if (!JS_IsString(path)) {
+		JS_ThrowTypeError(ctx, "Invalid argument");
+		return NULL;
 	}
-	return jsBlock;
+	auto job = new js_file_job_data();
+	const char *str = JS_ToCString(ctx, path);
+	job->path = str;
+	JS_FreeCString(ctx, str);
+	job->op = op;
+	return job;
 }
 
-JSValue jsBlockRemove(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Takes a path and `{encoding, mmap}`, resolves to a string, or an ArrayBuffer if `encoding` is null or mapping
+JSValue jsReadFile(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	auto block = getBlockThis(thiz);
-	if (!std::count(barBlocks.blocks.begin(), barBlocks.blocks.end(), block)) {
-		return JS_ThrowReferenceError(ctx, "Non-existent block");
+	if (argc < 1 || (argc >= 2 && !JS_IsUndefined(argv[1]) && !JS_IsObject(argv[1]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	barBlocks.blocks.erase(std::remove(barBlocks.blocks.begin(), barBlocks.blocks.end(), block), barBlocks.blocks.end());
-	return JS_UNDEFINED;
+	bool binary = false, map = false;
+	if (argc >= 2 && JS_IsObject(argv[1])) {
+		JSValue encoding = JS_GetPropertyStr(ctx, argv[1], "encoding");
+		const char *str = JS_IsString(encoding) ? JS_ToCString(ctx, encoding) : NULL;
+		bool known = JS_IsUndefined(encoding) || JS_IsNull(encoding) || (str && !strcmp(str, "utf8"));
+		binary = JS_IsNull(encoding);
+		if (str) {
+			JS_FreeCString(ctx, str);
+		}
+		JS_FreeValue(ctx, encoding);
+		if (!known) {
+			return JS_ThrowRangeError(ctx, "Unknown encoding, read an ArrayBuffer and use decodeText");
+		}
+		JSValue mmap = JS_GetPropertyStr(ctx, argv[1], "mmap");
+		map = JS_ToBool(ctx, mmap) > 0;
+		JS_FreeValue(ctx, mmap);
+	}
+	auto job = jsNewFileJob(ctx, FileOp::Read, argv[0]);
+	if (!job) {
+		return JS_EXCEPTION;
+	}
+	job->binary = binary || map; // Mapping only pays off if JS gets the pages as they are
+	job->map = map;
+	return jsFileStart(ctx, job);
 }
 
-// The resolver for `jsShell` which resolves the Promise, ran on the JS thread
-void jsShellResolve(std::vector<void*>& args)
+// Resolves to `{size, mtime, isFile, isDirectory}`
+JSValue jsStat(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-#ifdef DEBUG
-	printf("jsShellResolve\n");
-#endif
-	assert(args.size() == 1);
-	auto *td = (js_shell_thread_data*)args[0];
-	JSValue str = JS_NewString(td->ctx, td->result.c_str());
-	JSValue resp = JS_Call(td->ctx, td->success ? td->resolveFn : td->rejectFn, JS_UNDEFINED, 1, &str);
-	JS_FreeValue(td->ctx, resp);
-	JS_FreeValue(td->ctx, str);
-	JS_FreeValue(td->ctx, td->resolveFn);
-	JS_FreeValue(td->ctx, td->rejectFn);
-	td->thread.detach();
-	delete td;
+	if (argc != 1) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto job = jsNewFileJob(ctx, FileOp::Stat, argv[0]);
+	return job ? jsFileStart(ctx, job) : JS_EXCEPTION;
 }
 
-std::optional<std::string> runProcess(std::string& cmd)
+// Resolves to the last lines of a file
+JSValue jsTail(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	// Create pipes for menu
-	SECURITY_ATTRIBUTES sa = {
-		.nLength = sizeof(SECURITY_ATTRIBUTES),
-		.bInheritHandle = TRUE,
-	};
-	HANDLE stdoutR, stdoutW;
-	CreatePipe(&stdoutR, &stdoutW, &sa, 0);
-	assert(SetHandleInformation(stdoutR, HANDLE_FLAG_INHERIT, 0));
+	int32_t lines = 10;
+	if (argc < 1 || (argc >= 2 && (!JS_IsNumber(argv[1]) || JS_ToInt32(ctx, &lines, argv[1]) || lines < 1))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	auto job = jsNewFileJob(ctx, FileOp::Tail, argv[0]);
+	if (!job) {
+		return JS_EXCEPTION;
+	}
+	job->lines = lines;
+	return jsFileStart(ctx, job);
+}
 
-	// Open menu
-	PROCESS_INFORMATION pi;
-	STARTUPINFO si = {
-		.cb = sizeof(STARTUPINFO),
-		.dwFlags = STARTF_USESTDHANDLES,
-		.hStdOutput = stdoutW,
-		.hStdError = stdoutW,
-	};
-	if (!CreateProcessA(NULL, (LPSTR)cmd.c_str(), NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
-		CloseHandle(stdoutR);
-		CloseHandle(stdoutW);
-		return {};
+// Gets the bytes of an ArrayBuffer or typed array, returns false with an exception set otherwise
+bool jsGetBytes(JSContext *ctx, JSValueConst val, uint8_t **data, size_t *len)
+{
+	*data = JS_GetArrayBuffer(ctx, len, val);
+	if (*data) {
+		return true;
+	}
+	JS_FreeValue(ctx, JS_GetException(ctx));
+	size_t offset, bytesPerElement;
+	JSValue buf = JS_GetTypedArrayBuffer(ctx, val, &offset, len, &bytesPerElement);
+	if (JS_IsException(buf)) {
+		return false;
 	}
-	CloseHandle(stdoutW);
+	size_t bufLen;
+	*data = JS_GetArrayBuffer(ctx, &bufLen, buf);
+	JS_FreeValue(ctx, buf);
+	if (!*data) {
+		return false;
+	}
+	*data += offset;
+	return true;
+}
 
-	// Read output
-	std::string output;
-	char buf[4096];
-	DWORD bread;
-	while (ReadFile(stdoutR, buf, 4096, &bread, NULL)) {
-		output.append(buf, buf + bread);
+// Decodes an ArrayBuffer or typed array, `encoding` being 'utf8' (default), 'utf16le', 'oem' or 'ansi'
+JSValue jsDecodeText(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+{
+	if (argc < 1 || (argc >= 2 && !JS_IsString(argv[1]) && !JS_IsUndefined(argv[1]))) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
+	}
+	uint8_t *data;
+	size_t len;
+	if (!jsGetBytes(ctx, argv[0], &data, &len)) {
+		return JS_EXCEPTION;
+	}
+	std::string encoding = "utf8";
+	if (argc >= 2 && JS_IsString(argv[1])) {
+		const char *str = JS_ToCString(ctx, argv[1]);
+		encoding = str;
+		JS_FreeCString(ctx, str);
 	}
 
-	// Clean up
-	CloseHandle(stdoutR);
-	CloseHandle(pi.hProcess);
-	CloseHandle(pi.hThread);
+	if (encoding == "utf8") {
+		if (len >= 3 && !memcmp(data, "\xef\xbb\xbf", 3)) {
+			data += 3;
+			len -= 3;
+		}
+		return JS_NewStringLen(ctx, (const char*)data, len);
+	}
 
-	return std::make_optional<std::string>(output);
+	// Everything else goes through UTF-16 into the UTF-8 QuickJS takes
+	std::wstring wide;
+	if (encoding == "utf16le") {
+		wide.resize(len / 2);
+		memcpy(wide.data(), data, wide.size() * sizeof(wchar_t));
+	} else if (encoding == "oem" || encoding == "ansi") {
+		UINT codePage = encoding == "oem" ? CP_OEMCP : CP_ACP;
+		int required = MultiByteToWideChar(codePage, 0, (const char*)data, len, NULL, 0);
+		wide.resize(required);
+		MultiByteToWideChar(codePage, 0, (const char*)data, len, wide.data(), required);
+	} else {
+		return JS_ThrowRangeError(ctx, "Unknown encoding '%s'", encoding.c_str());
+	}
+	size_t skip = !wide.empty() && wide[0] == 0xfeff ? 1 : 0;
+	int required = WideCharToMultiByte(CP_UTF8, 0, wide.data() + skip, wide.size() - skip, NULL, 0, NULL, NULL);
+	std::string utf8(required, 0);
+	WideCharToMultiByte(CP_UTF8, 0, wide.data() + skip, wide.size() - skip, utf8.data(), required, NULL, NULL);
+	return JS_NewStringLen(ctx, utf8.data(), utf8.size());
 }
 
-// The command runner for `jsShell`, ran on a different thread
-void jsShellThread(js_shell_thread_data *td)
+JSValue jsKVGet(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-#ifdef DEBUG
-	printf("jsShellThread\n");
-#endif
-	auto res = runProcess(td->cmd);
-	if (res.has_value()) {
-		td->success = true;
-		td->result = res.value();
-	} else {
-		td->success = false;
-		td->result = "failed to run command";
+	if (argc != 1 || !JS_IsString(argv[0])) {
+		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	jsThreadQueueMutex.lock();
-	jsThreadQueue.push_back(std::make_pair(jsShellResolve, std::vector({(void*)td})));
-	jsThreadQueueMutex.unlock();
+	size_t len;
+	const char *key = JS_ToCStringLen(ctx, &len, argv[0]);
+	KVStore::Value value;
+	std::lock_guard<std::mutex> lock(kvMutex);
+	bool found = kvStore.get(std::string(key, len), value);
+	JS_FreeCString(ctx, key);
+	if (!found) {
+		return JS_UNDEFINED;
+	}
+	return value.binary
+		? JS_NewArrayBufferCopy(ctx, (const uint8_t*)value.data, value.len)
+		: JS_NewStringLen(ctx, value.data, value.len);
 }
 
-// The "lambda" put into the Promise constructor returned from `jsShell`, ran on the JS thread
-JSValue jsShellPromiseCb(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+// Takes a string, ArrayBuffer or typed array, with an optional TTL in seconds
+JSValue jsKVSet(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	if (argc != 2 || !JS_IsFunction(ctx, argv[0]) || !JS_IsFunction(ctx, argv[1]) || !jsShellTempCmd) {
+	if (argc < 2 || argc > 3 || !JS_IsString(argv[0]) || (argc == 3 && !JS_IsNumber(argv[2]))) {
 		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	auto td = new js_shell_thread_data();
-	td->resolveFn = JS_DupValue(ctx, argv[0]);
-	td->rejectFn = JS_DupValue(ctx, argv[1]);
-	td->ctx = ctx;
-	td->cmd = std::string(jsShellTempCmd);
-	JS_FreeCString(ctx, jsShellTempCmd);
-	jsShellTempCmd = NULL;
-	td->thread = std::thread(jsShellThread, td);
-	return JS_UNDEFINED;
+	int64_t expiresAt = 0;
+	if (argc == 3) {
+		double ttl;
+		JS_ToFloat64(ctx, &ttl, argv[2]);
+		if (!(ttl >= 0 && ttl <= WBLOCKS_KV_MAX_TTL)) {
+			return JS_ThrowRangeError(ctx, "TTL must be between 0 and 100 years in seconds");
+		}
+		expiresAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count() + (int64_t)(ttl * 1000);
+	}
+
+	size_t keyLen;
+	const char *key = JS_ToCStringLen(ctx, &keyLen, argv[0]);
+	std::lock_guard<std::mutex> lock(kvMutex);
+	bool ok;
+	if (JS_IsString(argv[1])) {
+		size_t len;
+		const char *str = JS_ToCStringLen(ctx, &len, argv[1]);
+		ok = kvStore.set(std::string(key, keyLen), str, len, false, expiresAt);
+		JS_FreeCString(ctx, str);
+	} else {
+		uint8_t *data;
+		size_t len;
+		if (!jsGetBytes(ctx, argv[1], &data, &len)) {
+			JS_FreeCString(ctx, key);
+			return JS_EXCEPTION;
+		}
+		ok = kvStore.set(std::string(key, keyLen), data, len, true, expiresAt);
+	}
+	JS_FreeCString(ctx, key);
+	return ok ? JS_UNDEFINED : JS_ThrowInternalError(ctx, "Failed to write to store");
 }
 
-// Function the user calls from `$`
-JSValue jsShell(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
+JSValue jsKVDelete(JSContext *ctx, JSValueConst thiz, int argc, JSValueConst *argv)
 {
-	// TODO: make this a tag template function instead...?
 	if (argc != 1 || !JS_IsString(argv[0])) {
 		return JS_ThrowTypeError(ctx, "Invalid argument");
 	}
-	JSValue global = JS_GetGlobalObject(ctx);
-	JSValue promiseClass = JS_GetPropertyStr(ctx, global, "Promise");
-	JSValue fn = JS_NewCFunction(ctx, jsShellPromiseCb, "$__callback", 2);
-	jsShellTempCmd = JS_ToCString(ctx, argv[0]);
-	JSValue promise = JS_CallConstructor(ctx, promiseClass, 1, &fn);
-	JS_FreeValue(ctx, fn);
-	assert(!jsShellTempCmd);
-	JS_FreeValue(ctx, promiseClass);
-	JS_FreeValue(ctx, global);
-	return promise;
+	size_t len;
+	const char *key = JS_ToCStringLen(ctx, &len, argv[0]);
+	std::unique_lock<std::mutex> lock(kvMutex);
+	bool removed = kvStore.remove(std::string(key, len));
+	lock.unlock();
+	JS_FreeCString(ctx, key);
+	return JS_NewBool(ctx, removed);
 }
 
 void jsThreadFn()
 {
 	// Init runtime
-	JSRuntime *rt = JS_NewRuntime();
+	JSRuntime *rt = JS_NewRuntime2(&jsMemFunctions, NULL);
 	assert(rt);
+	JS_SetMemoryLimit(rt, WBLOCKS_JS_MEMORY_LIMIT);
+	JS_SetInterruptHandler(rt, jsInterruptHandler, NULL);
 	js_std_set_worker_new_context_func(JS_NewContext);
 	js_std_init_handlers(rt);
 	JS_SetModuleLoaderFunc(rt, NULL, js_module_loader, NULL);
 
+	ioPool = new WorkerPool(WBLOCKS_IO_THREADS);
+
+	// Image decoding goes through WIC
+	assert(SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED)));
+	assert(SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER,
+			IID_IWICImagingFactory, (void**)&wicFactory)));
+
+	// Open persistent state before any script runs
+	{
+		std::lock_guard<std::mutex> lock(kvMutex);
+		bool opened = false;
+		for (int attempt = 0; !(opened = kvStore.open(WBLOCKS_KVFILE, WBLOCKS_KV_INITIAL_SIZE))
+				&& attempt < WBLOCKS_KV_OPEN_RETRIES; attempt++) {
+			Sleep(50 << attempt);
+		}
+		if (!opened) {
+			err("failed to open " WBLOCKS_KVFILE);
+		}
+	}
+
 	// Init context
 	JSContext *ctx = JS_NewContext(rt);
 	assert(ctx);
@@ -567,14 +3076,38 @@ void jsThreadFn()
 		JS_NewClass(rt, jsBlockClassId, &jsBlockClass);
 
 		JSValue proto = JS_NewObject(ctx);
-		QJS_SET_PROP_FN(ctx, proto, "setFont", jsWrapBlockFn<jsBlockSetFont>, 2);
-		QJS_SET_PROP_FN(ctx, proto, "setText", jsWrapBlockFn<jsBlockSetText>, 1);
-		QJS_SET_PROP_FN(ctx, proto, "setColor", jsWrapBlockFn<jsBlockSetColor>, 3);
-		QJS_SET_PROP_FN(ctx, proto, "setPadding", jsWrapBlockFn<jsBlockSetPadding>, 2);
-		QJS_SET_PROP_FN(ctx, proto, "setVisible", jsWrapBlockFn<jsBlockSetVisible>, 1);
+		QJS_SET_PROP_FN(ctx, proto, "setFont", jsBlockSetter<blockSetFont>, jsSetterArity<blockSetFont>);
+		QJS_SET_PROP_FN(ctx, proto, "setText", jsBlockSetter<blockSetText>, jsSetterArity<blockSetText>);
+		QJS_SET_PROP_FN(ctx, proto, "setSegments", jsBlockSetSegments, 1);
+		QJS_SET_PROP_FN(ctx, proto, "setColor", jsBlockSetter<blockSetColor>, jsSetterArity<blockSetColor>);
+		QJS_SET_PROP_FN(ctx, proto, "setPadding", jsBlockSetter<blockSetPadding>, jsSetterArity<blockSetPadding>);
+		QJS_SET_PROP_FN(ctx, proto, "setVisible", jsBlockSetter<blockSetVisible>, jsSetterArity<blockSetVisible>);
+		QJS_SET_PROP_FN(ctx, proto, "setGroup", jsBlockSetter<blockSetGroup>, jsSetterArity<blockSetGroup>);
+		QJS_SET_PROP_FN(ctx, proto, "setWidth", jsBlockSetter<blockSetWidth>, jsSetterArity<blockSetWidth>);
+		QJS_SET_PROP_FN(ctx, proto, "setPriority", jsBlockSetter<blockSetPriority>, jsSetterArity<blockSetPriority>);
+		QJS_SET_PROP_FN(ctx, proto, "setOverflow", jsBlockSetter<blockSetOverflow>, jsSetterArity<blockSetOverflow>);
+		QJS_SET_PROP_FN(ctx, proto, "setSeparator", jsBlockSetter<blockSetSeparator>, jsSetterArity<blockSetSeparator>);
+		QJS_SET_PROP_FN(ctx, proto, "setAnimation", jsBlockSetter<blockSetAnimation>, jsSetterArity<blockSetAnimation>);
+		QJS_SET_PROP_FN(ctx, proto, "set", jsBlockSet, 1);
+		QJS_SET_PROP_FN(ctx, proto, "setBars", jsBlockSetBars, 1);
+		QJS_SET_PROP_FN(ctx, proto, "setImage", jsBlockSetImage, 2);
+		QJS_SET_PROP_FN(ctx, proto, "setGraph", jsBlockSetGraph, 1);
+		QJS_SET_PROP_FN(ctx, proto, "pushSamples", jsWrapBlockFn<jsBlockPushSamples>, 1);
+		QJS_SET_PROP_FN(ctx, proto, "commitSamples", jsWrapBlockFn<jsBlockCommitSamples>, 1);
+		QJS_SET_PROP_FN(ctx, proto, "onClick", jsWrapBlockFn<jsBlockOnClick>, 1);
+		QJS_SET_PROP_FN(ctx, proto, "onScroll", jsWrapBlockFn<jsBlockOnScroll>, 1);
+		QJS_SET_PROP_FN(ctx, proto, "onHover", jsWrapBlockFn<jsBlockOnHover>, 1);
 		QJS_SET_PROP_FN(ctx, proto, "clone", jsWrapBlockFn<jsBlockClone>, 1);
 		QJS_SET_PROP_FN(ctx, proto, "remove", jsWrapBlockFn<jsBlockRemove>, 0);
+		QJS_SET_PROP_FN(ctx, proto, "setName", jsWrapBlockFn<jsBlockSetName>, 1);
 		JS_SetClassProto(ctx, jsBlockClassId, proto);
+		for (size_t i = 0; i < std::size(jsBlockProps); i++) {
+			jsBlockPropAtoms[i] = JS_NewAtom(ctx, jsBlockProps[i].name);
+		}
+
+		JS_NewClassID(&jsImageClassId);
+		static const JSClassDef jsImageClass = { .class_name = "Image", .finalizer = jsImageFinalizer };
+		JS_NewClass(rt, jsImageClassId, &jsImageClass);
 	}
 
 	// Create default block
@@ -585,12 +3118,39 @@ void jsThreadFn()
 	{
 		JSValue global = JS_GetGlobalObject(ctx);
 		QJS_SET_PROP_FN(ctx, global, "createBlock", jsWrapBlockFn<jsCreateBlock>, 0);
-		QJS_SET_PROP_FN(ctx, global, "$", jsShell, 1);
+		QJS_SET_PROP_FN(ctx, global, "$", jsShell, 2);
+		QJS_SET_PROP_FN(ctx, global, "$json", jsShellJson, 3);
+		QJS_SET_PROP_FN(ctx, global, "$bytes", jsShellBytes, 2);
+		QJS_SET_PROP_FN(ctx, global, "decodeText", jsDecodeText, 2);
+		QJS_SET_PROP_FN(ctx, global, "readFile", jsReadFile, 2);
+		QJS_SET_PROP_FN(ctx, global, "stat", jsStat, 1);
+		QJS_SET_PROP_FN(ctx, global, "tail", jsTail, 2);
+		QJS_SET_PROP_FN(ctx, global, "setMemoryLimit", jsSetMemoryLimit, 1);
+		QJS_SET_PROP_FN(ctx, global, "setGCThreshold", jsSetGCThreshold, 1);
+		QJS_SET_PROP_FN(ctx, global, "setCallbackBudget", jsSetCallbackBudget, 1);
+		QJS_SET_PROP_FN(ctx, global, "setTimerStretch", jsSetTimerStretch, 1);
+		QJS_SET_PROP_FN(ctx, global, "memoryUsage", jsMemoryUsage, 0);
+		QJS_SET_PROP_FN(ctx, global, "loadImage", jsLoadImage, 2);
 		JS_SetPropertyStr(ctx, global, "defaultBlock", jsDefaultBlock);
 
+		JSValue kv = JS_NewObject(ctx);
+		JS_SetPropertyStr(ctx, global, "kv", kv);
+		QJS_SET_PROP_FN(ctx, kv, "get", jsKVGet, 1);
+		QJS_SET_PROP_FN(ctx, kv, "set", jsKVSet, 3);
+		QJS_SET_PROP_FN(ctx, kv, "delete", jsKVDelete, 1);
+
 		JSValue wbc = JS_NewObject(ctx);
 		JS_SetPropertyStr(ctx, global, "__wbc", wbc);
 		QJS_SET_PROP_FN(ctx, wbc, "yieldToC", jsYieldToC, 0);
+		QJS_SET_PROP_FN(ctx, wbc, "timerStretch", jsTimerStretch, 0);
+		QJS_SET_PROP_FN(ctx, wbc, "log", jsLog, 2);
+		QJS_SET_PROP_FN(ctx, wbc, "registerScript", jsRegisterScript, 1);
+		QJS_SET_PROP_FN(ctx, wbc, "enterScript", jsEnterScript, 1);
+		QJS_SET_PROP_FN(ctx, wbc, "runPendingJobs", jsRunPendingJobsFn, 0);
+		QJS_SET_PROP_FN(ctx, wbc, "currentScript", jsCurrentScript, 0);
+		QJS_SET_PROP_FN(ctx, wbc, "scriptDisabled", jsScriptDisabled, 1);
+		QJS_SET_PROP_FN(ctx, wbc, "isolate", jsIsolate, 1);
+		QJS_SET_PROP_FN(ctx, wbc, "loadNativeBlock", jsLoadNativeBlock, 1);
 		JS_FreeValue(ctx, global);
 	}
 
@@ -605,22 +3165,69 @@ void jsThreadFn()
 	js_std_loop(ctx);
 }
 
+// Runs on the IPC thread, the whole batch goes in under one lock
+void applyIpcBatch(std::vector<IpcMessage>& batch)
+{
+	std::lock_guard<std::mutex> lock(barBlocks.mutex);
+	for (IpcMessage& msg : batch) {
+		auto named = barBlocks.named.find(msg.name);
+		if (msg.op == IpcOp::Remove) {
+			// Only blocks the pushes made, scripts own theirs
+			if (named != barBlocks.named.end() && barBlocks.pushed.count(named->second)) {
+				dropPushedBlock(named->second);
+				barBlocks.named.erase(named);
+			}
+			continue;
+		}
+		Block *block;
+		if (named != barBlocks.named.end()) {
+			block = named->second;
+		} else if (barBlocks.pushed.size() < WBLOCKS_MAX_PUSHED_BLOCKS) {
+			block = newBlock(barBlocks.defaultBlock);
+			barBlocks.named.emplace(msg.name, block);
+			barBlocks.pushed.insert(block);
+		} else {
+			stats.ipcDropped.add();
+			continue;
+		}
+		switch (msg.op) {
+		case IpcOp::Text:
+			block->setText(msg.value);
+			block->traceState(TraceOp::Text);
+			break;
+		case IpcOp::Color:
+			block->color = RGB((uint8_t)msg.value[0], (uint8_t)msg.value[1], (uint8_t)msg.value[2]);
+			block->traceState(TraceOp::Color);
+			break;
+		case IpcOp::Visible:
+			block->visible = msg.value[0];
+			block->traceState(TraceOp::Visible);
+			break;
+		case IpcOp::Remove:
+			break; // Handled above
+		}
+	}
+	barBlocks.needsUpdate = true;
+}
+
 int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdShow)
 {
 	hInst = inst;
 
-	// Create console and redirect output
+	// Create console and start logging, stdio goes through the logger unless debugging
 	assert(AllocConsole());
 #ifdef DEBUG
 	assert(freopen("CONOUT$", "w", stdout));
 	assert(freopen("CONOUT$", "w", stderr));
+	logInit(WBLOCKS_LOGFILE, WBLOCKS_LOG_MAX_BYTES, WBLOCKS_LOG_KEEP, true);
 #else
 	ShowWindow(GetConsoleWindow(), 0);
-	assert(freopen(WBLOCKS_LOGFILE, "w", stdout));
+	assert(freopen("NUL", "w", stdout));
 	assert(freopen("NUL", "w", stderr));
-	assert(!_dup2(_fileno(stdout), _fileno(stderr)));
+	logInit(WBLOCKS_LOGFILE, WBLOCKS_LOG_MAX_BYTES, WBLOCKS_LOG_KEEP, false);
+	assert(logCaptureStdio());
 #endif
-	setvbuf(stdout, NULL, _IONBF, 0);
+	setvbuf(stdout, NULL, _IONBF, 0); // Only writes to a pipe or the console now
 	setvbuf(stderr, NULL, _IONBF, 0);
 
 	// Reg class
@@ -631,19 +3238,37 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
 	wc.hCursor = LoadCursor(NULL, IDC_ARROW);
 	assert(RegisterClassEx(&wc));
 
+	// Record from the very start if asked to
+	const char *tracePath = getenv("WBLOCKS_TRACE");
+	if (tracePath && *tracePath) {
+		startTrace(tracePath);
+	}
+
 	// Create bar
 	createWindow();
 
+	// Accept pushed updates
+	std::string ipcErr;
+	if (!ipcListen(ipcDefaultEndpoint(), applyIpcBatch, ipcErr)) {
+		err(ipcErr.c_str());
+	}
+
 	// Create JS state
 	auto jsThread = std::thread(jsThreadFn);
 
 	// Main loop
 	while (true) {
+		power.update(nowUs());
 		checkBarSize(); // TODO: timer instead
 
+		// Changes while hidden are drawn as one frame once visible again
 		barBlocks.mutex.lock();
-		if (wb.wnd && barBlocks.needsUpdate) {
-			updateBlocks(wb.wnd);
+		if (!wb.bars.empty()) {
+			if (power.shouldDraw(barBlocks.needsUpdate)) {
+				updateBlocks();
+			} else if (power.visible() && wb.frameClock.tick(nowUs())) {
+				drawAnimations(wb.frameClock.now());
+			}
 			barBlocks.needsUpdate = false; // TODO: window message instead
 		}
 		barBlocks.mutex.unlock();
@@ -654,7 +3279,7 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
 			DispatchMessage(&msg);
 		}
 
-		Sleep(10);
+		Sleep(power.visible() ? WBLOCKS_LOOP_MS : WBLOCKS_HIDDEN_LOOP_MS);
 	}
 
 	jsThread.join();
@@ -0,0 +1,305 @@
+#include "nativeblock.h"
+#include "process.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+static std::string_view trim(std::string_view str)
+{
+	size_t start = str.find_first_not_of(" \t\r\n");
+	if (start == std::string_view::npos) {
+		return {};
+	}
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end - start + 1);
+}
+
+// Seconds, fractions allowed
+static bool parseSeconds(const std::string& str, uint32_t *ms)
+{
+	char *end;
+	double secs = strtod(str.c_str(), &end);
+	if (end == str.c_str() || *end || !std::isfinite(secs) || secs <= 0 || secs > 86400 * 7) {
+		return false;
+	}
+	*ms = std::max((uint32_t)(secs * 1000), (uint32_t)1);
+	return true;
+}
+
+// `r g b`, spaces or commas between
+static bool parseColor(const std::string& str, uint32_t *color)
+{
+	const char *p = str.c_str();
+	uint32_t rgb[3];
+	for (int i = 0; i < 3; i++) {
+		while (*p == ' ' || *p == '\t' || *p == ',') {
+			p++;
+		}
+		char *end;
+		long v = strtol(p, &end, 10);
+		if (end == p || v < 0 || v > 255) {
+			return false;
+		}
+		rgb[i] = v;
+		p = end;
+	}
+	if (!trim(p).empty()) {
+		return false;
+	}
+	*color = rgb[0] | (rgb[1] << 8) | (rgb[2] << 16);
+	return true;
+}
+
+// `color <op> <number> = r g b`, `rest` starting at the op
+static bool parseThreshold(std::string_view rest, ColorThreshold& threshold, std::string_view& value)
+{
+	if (rest.empty() || (rest[0] != '<' && rest[0] != '>')) {
+		return false;
+	}
+	bool less = rest[0] == '<';
+	bool orEqual = rest.size() > 1 && rest[1] == '=';
+	threshold.op = less ? (orEqual ? ThresholdOp::LessEqual : ThresholdOp::Less)
+			: (orEqual ? ThresholdOp::GreaterEqual : ThresholdOp::Greater);
+	rest.remove_prefix(orEqual ? 2 : 1);
+
+	size_t eq = rest.find('=');
+	if (eq == std::string_view::npos) {
+		return false;
+	}
+	std::string num(trim(rest.substr(0, eq)));
+	char *end;
+	threshold.value = strtod(num.c_str(), &end);
+	if (num.empty() || *end) {
+		return false;
+	}
+	value = trim(rest.substr(eq + 1));
+	return true;
+}
+
+bool parseNativeBlock(std::string_view src, NativeBlockDef& def, std::string& err)
+{
+	int lineNo = 0;
+	auto fail = [&](const char *msg) {
+		err = "line " + std::to_string(lineNo) + ": " + msg;
+		return false;
+	};
+	while (!src.empty()) {
+		size_t nl = src.find('\n');
+		std::string_view line = trim(src.substr(0, nl));
+		src.remove_prefix(nl == std::string_view::npos ? src.size() : nl + 1);
+		lineNo++;
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		size_t keyEnd = line.find_first_of(" \t=<>");
+		std::string_view key = line.substr(0, keyEnd);
+		std::string_view rest = keyEnd == std::string_view::npos ? std::string_view() : trim(line.substr(keyEnd));
+		if (key == "color" && !rest.empty() && rest[0] != '=') {
+			ColorThreshold threshold;
+			std::string_view value;
+			if (!parseThreshold(rest, threshold, value) || !parseColor(std::string(value), &threshold.color)) {
+				return fail("expected `color <op> number = r g b`");
+			}
+			def.thresholds.push_back(threshold);
+			continue;
+		}
+		if (rest.empty() || rest[0] != '=') {
+			return fail("expected `key = value`");
+		}
+		std::string value(trim(rest.substr(1)));
+
+		if (key == "command") {
+			def.command = value;
+		} else if (key == "interval") {
+			if (!parseSeconds(value, &def.intervalMs)) {
+				return fail("interval must be a positive number of seconds");
+			}
+		} else if (key == "timeout") {
+			if (!parseSeconds(value, &def.timeoutMs)) {
+				return fail("timeout must be a positive number of seconds");
+			}
+		} else if (key == "match") {
+			try {
+				def.match.emplace(value, std::regex::ECMAScript | std::regex::optimize);
+			} catch (const std::regex_error& ex) {
+				return fail(ex.what());
+			}
+		} else if (key == "format") {
+			def.format = value;
+		} else if (key == "color") {
+			uint32_t color;
+			if (!parseColor(value, &color)) {
+				return fail("expected `color = r g b`");
+			}
+			def.color = color;
+		} else if (key == "group") {
+			if (value == "left") {
+				def.group = LayoutGroup::Left;
+			} else if (value == "center") {
+				def.group = LayoutGroup::Center;
+			} else if (value == "right") {
+				def.group = LayoutGroup::Right;
+			} else {
+				return fail("group must be left, center or right");
+			}
+		} else if (key == "name") {
+			if (value.empty() || value.size() > 255) {
+				return fail("name must be 1 to 255 bytes");
+			}
+			def.name = value;
+		} else {
+			return fail("unknown key");
+		}
+	}
+	if (def.command.empty()) {
+		err = "no command";
+		return false;
+	}
+	return true;
+}
+
+static bool thresholdHolds(const ColorThreshold& threshold, double value)
+{
+	switch (threshold.op) {
+	case ThresholdOp::Less:
+		return value < threshold.value;
+	case ThresholdOp::LessEqual:
+		return value <= threshold.value;
+	case ThresholdOp::Greater:
+		return value > threshold.value;
+	case ThresholdOp::GreaterEqual:
+		return value >= threshold.value;
+	}
+	return false;
+}
+
+bool renderNativeBlock(const NativeBlockDef& def, std::string_view output, std::string& text,
+		std::optional<uint32_t>& color)
+{
+	output = trim(output);
+	std::match_results<std::string_view::const_iterator> m;
+	if (def.match && !std::regex_search(output.begin(), output.end(), m, *def.match)) {
+		return false;
+	}
+	auto capture = [&](size_t i) -> std::string_view {
+		if (!def.match) {
+			return i == 0 ? output : std::string_view();
+		}
+		if (i >= m.size() || !m[i].matched) {
+			return {};
+		}
+		return std::string_view(&*m[i].first, m[i].length());
+	};
+
+	// `$0` to `$9` are captures, `$$` is a dollar sign
+	text.clear();
+	for (size_t i = 0; i < def.format.size(); i++) {
+		char c = def.format[i];
+		if (c == '$' && i + 1 < def.format.size()) {
+			char next = def.format[i + 1];
+			if (next >= '0' && next <= '9') {
+				text += capture(next - '0');
+				i++;
+				continue;
+			}
+			if (next == '$') {
+				i++;
+			}
+		}
+		text += c;
+	}
+
+	if (def.color) {
+		color = def.color;
+	}
+	if (!def.thresholds.empty()) {
+		std::string number(capture(def.match && def.match->mark_count() ? 1 : 0));
+		char *end;
+		double value = strtod(number.c_str(), &end);
+		if (end != number.c_str()) {
+			for (const ColorThreshold& threshold : def.thresholds) {
+				if (thresholdHolds(threshold, value)) {
+					color = threshold.color;
+					break;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+NativeScheduler::NativeScheduler(size_t threads, NativeBlockUpdate update, const PowerPolicy *power) :
+		pool(threads), update(std::move(update)), power(power)
+{
+	std::thread(&NativeScheduler::threadFn, this).detach();
+}
+
+void NativeScheduler::add(NativeBlockDef def, void *block)
+{
+	auto entry = std::make_unique<Entry>();
+	entry->def = std::move(def);
+	entry->block = block;
+	entry->due = nowUs();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.push_back(std::move(entry));
+	}
+	wake.notify_one();
+}
+
+void NativeScheduler::run(Entry *entry)
+{
+	const NativeBlockDef& def = entry->def;
+	ProcessOptions options = { .timeoutMs = def.timeoutMs ? def.timeoutMs : def.intervalMs };
+	ProcessOutput output;
+	bool ok = !processEndError(Process().run(def.command, options, output));
+
+	// Everything from here on is what a JS block would spend in the engine
+	uint64_t start = nowUs();
+	std::string text;
+	std::optional<uint32_t> color;
+	ok = ok && renderNativeBlock(def, std::string_view((const char*)output.data, output.len), text, color);
+	if (ok) {
+		update(entry->block, text, color);
+		stats.nativeBlockTick.record(nowUs() - start);
+	} else {
+		stats.nativeBlockFailures.add();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entry->running = false;
+	}
+	wake.notify_one();
+}
+
+void NativeScheduler::threadFn()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		uint64_t now = nowUs(), next = UINT64_MAX;
+		double stretch = power ? power->timerStretch() : 1;
+		for (auto& entry : entries) {
+			if (entry->running) {
+				continue;
+			}
+			if (entry->due <= now) {
+				// Ticks missed while a run overran are dropped, not caught up on
+				entry->due = std::max(entry->due + (uint64_t)(entry->def.intervalMs * stretch) * 1000, now);
+				entry->running = true;
+				pool.submit([this, e = entry.get()] { run(e); });
+				continue;
+			}
+			next = std::min(next, entry->due);
+		}
+		if (next == UINT64_MAX) {
+			wake.wait(lock);
+		} else {
+			wake.wait_for(lock, std::chrono::microseconds(next - now));
+		}
+	}
+}
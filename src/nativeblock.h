@@ -0,0 +1,88 @@
+#pragma once
+
+// Blocks described by a `.block` file rather than a script, updated without going through JS
+//
+//   # CPU load every 5 seconds, red above 90%
+//   command = wmic cpu get loadpercentage
+//   interval = 5
+//   match = (\d+)
+//   format = CPU $1%
+//   color = 255 255 255
+//   color > 90 = 255 80 80
+//
+// A scheduler thread hands due commands to a worker pool. The output is searched for `match`,
+// the captures fill in `format` and the first capture (or the whole match) picks a color.
+
+#include "layout.h"
+#include "power.h"
+#include "workerpool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class ThresholdOp { Less, LessEqual, Greater, GreaterEqual };
+
+struct ColorThreshold {
+	ThresholdOp op;
+	double value;
+	uint32_t color;
+};
+
+struct NativeBlockDef {
+	std::string command;
+	uint32_t intervalMs = 5000;
+	uint32_t timeoutMs = 0; // 0 for the interval
+	std::optional<std::regex> match;
+	std::string format = "$0";
+	std::optional<uint32_t> color; // Colors are 0x00BBGGRR, like a COLORREF
+	std::vector<ColorThreshold> thresholds; // First one that holds wins over `color`
+	std::optional<LayoutGroup> group;
+	std::string name; // For IPC pushes, see ipc.h
+};
+
+// Reads a definition, false with `err` naming the line on a mistake
+bool parseNativeBlock(std::string_view src, NativeBlockDef& def, std::string& err);
+
+// What a block shows for some command output, false if `match` didn't match.
+// `color` is left alone if nothing sets it.
+bool renderNativeBlock(const NativeBlockDef& def, std::string_view output, std::string& text,
+		std::optional<uint32_t>& color);
+
+using NativeBlockUpdate = std::function<void(void *block, const std::string& text, std::optional<uint32_t> color)>;
+
+// Runs every definition's command on its interval and calls `update` with the result, from a
+// worker thread. A tick is skipped while the last run of the same block is still going.
+// Lives as long as the process.
+class NativeScheduler {
+	struct Entry {
+		NativeBlockDef def;
+		void *block;
+		uint64_t due; // In `nowUs` time
+		bool running = false;
+	};
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<std::unique_ptr<Entry>> entries;
+	WorkerPool pool;
+	NativeBlockUpdate update;
+	const PowerPolicy *power;
+
+	void threadFn();
+	void run(Entry *entry);
+
+public:
+	// Intervals are stretched like script timers while `power` says the bar is hidden
+	NativeScheduler(size_t threads, NativeBlockUpdate update, const PowerPolicy *power = nullptr);
+
+	// Runs right away, then every interval
+	void add(NativeBlockDef def, void *block);
+};
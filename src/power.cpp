@@ -0,0 +1,35 @@
+#include "power.h"
+#include "stats.h"
+
+bool PowerPolicy::update(uint64_t nowUs)
+{
+	if (polled && nowUs - lastPollUs < pollMs * (uint64_t)1000) {
+		return false;
+	}
+	polled = true;
+	lastPollUs = nowUs;
+	Visibility next = source.poll();
+	if (next == current()) {
+		return false;
+	}
+	visibility.store(next, std::memory_order_relaxed);
+	stats.visibilityChanges.add();
+	return true;
+}
+
+bool PowerPolicy::shouldDraw(bool dirty)
+{
+	if (!visible()) {
+		if (dirty) {
+			deferred = true;
+			stats.framesDeferred.add();
+		}
+		return false;
+	}
+	if (deferred) {
+		deferred = false;
+		stats.catchUpFrames.add();
+		return true;
+	}
+	return dirty;
+}
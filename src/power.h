@@ -0,0 +1,68 @@
+#pragma once
+
+// Backing off while nobody can see the bar
+//
+// A visibility source says whether the taskbar can be seen. While it can't, frames are held back and
+// drawn as one when it's visible again, and timers run `timerStretch` times slower. The source is only
+// polled, so a fake one can drive the policy anywhere.
+
+#include <atomic>
+#include <cstdint>
+
+#define POWER_MAX_TIMER_STRETCH 100 // Keeps stretched delays finite
+
+enum class Visibility {
+	Visible,
+	Hidden, // Auto-hidden or under a fullscreen window
+	Locked, // Session locked
+};
+
+class VisibilitySource {
+public:
+	virtual ~VisibilitySource() = default;
+
+	// Called on the thread driving the policy
+	virtual Visibility poll() = 0;
+};
+
+class PowerPolicy {
+	VisibilitySource& source;
+	uint32_t pollMs;
+	uint64_t lastPollUs = 0;
+	bool polled = false;
+	bool deferred = false; // A frame was held back
+	std::atomic<Visibility> visibility{Visibility::Visible};
+	std::atomic<double> stretch;
+
+public:
+	PowerPolicy(VisibilitySource& source, double stretch, uint32_t pollMs) :
+			source(source), pollMs(pollMs) {
+		setTimerStretch(stretch);
+	};
+
+	// Polls the source if it's due, returning true if the visibility changed
+	bool update(uint64_t nowUs);
+
+	// Whether to draw now, `dirty` if something changed since the last frame. Frames while not visible
+	// are held back and drawn as a single catch up frame once visible again.
+	bool shouldDraw(bool dirty);
+
+	Visibility current() const {
+		return visibility.load(std::memory_order_relaxed);
+	}
+
+	bool visible() const {
+		return current() == Visibility::Visible;
+	}
+
+	// What to multiply timer delays by right now, from any thread
+	double timerStretch() const {
+		return visible() ? 1 : stretch.load(std::memory_order_relaxed);
+	}
+
+	// Clamped to 1 to POWER_MAX_TIMER_STRETCH, 1 for timers to keep their pace while hidden
+	void setTimerStretch(double factor) {
+		factor = factor >= 1 ? factor : 1; // And NaN
+		stretch.store(factor < POWER_MAX_TIMER_STRETCH ? factor : POWER_MAX_TIMER_STRETCH, std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,286 @@
+#include "process.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define PROCESS_READ_SIZE 4096
+
+ProcessOutput::~ProcessOutput()
+{
+	free(data);
+}
+
+bool ProcessOutput::reserve(size_t n)
+{
+	if (cap - len >= n) {
+		return true;
+	}
+	size_t newCap = std::max(cap + cap / 2, len + n);
+	auto newData = (uint8_t*)realloc(data, newCap);
+	if (!newData) {
+		return false;
+	}
+	data = newData;
+	cap = newCap;
+	return true;
+}
+
+uint8_t *ProcessOutput::release()
+{
+	uint8_t *out = len ? (uint8_t*)realloc(data, len) : nullptr;
+	if (!out) {
+		out = data;
+	}
+	data = nullptr;
+	len = cap = 0;
+	return out;
+}
+
+// Kills processes past their deadline, leaked so it outlives static destruction
+struct Watchdog {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::multimap<uint64_t, Process*> deadlines; // In `nowUs` time
+	bool started = false;
+};
+static Watchdog& watchdog = *new Watchdog();
+
+static void watchdogThreadFn()
+{
+	std::unique_lock<std::mutex> lock(watchdog.mutex);
+	while (true) {
+		if (watchdog.deadlines.empty()) {
+			watchdog.wake.wait(lock);
+			continue;
+		}
+		auto first = watchdog.deadlines.begin();
+		uint64_t now = nowUs();
+		if (first->first > now) {
+			watchdog.wake.wait_for(lock, std::chrono::microseconds(first->first - now));
+			continue;
+		}
+		first->second->kill(ProcessEnd::TimedOut);
+		watchdog.deadlines.erase(first);
+	}
+}
+
+static void watchProcess(Process *process, uint32_t timeoutMs)
+{
+	std::lock_guard<std::mutex> lock(watchdog.mutex);
+	if (!watchdog.started) {
+		std::thread(watchdogThreadFn).detach();
+		watchdog.started = true;
+	}
+	watchdog.deadlines.emplace(nowUs() + timeoutMs * (uint64_t)1000, process);
+	watchdog.wake.notify_one();
+}
+
+static void unwatchProcess(Process *process)
+{
+	std::lock_guard<std::mutex> lock(watchdog.mutex);
+	for (auto it = watchdog.deadlines.begin(); it != watchdog.deadlines.end(); it++) {
+		if (it->second == process) {
+			watchdog.deadlines.erase(it);
+			break;
+		}
+	}
+}
+
+void Process::kill(ProcessEnd reason)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (killedFor != ProcessEnd::Exited || finished) {
+		return;
+	}
+	killedFor = reason;
+	if (running) {
+		killTree();
+	}
+}
+
+// Called with the mutex held
+void Process::killTree()
+{
+#ifdef _WIN32
+	TerminateJobObject(job, 1);
+#else
+	::kill(-pgid, SIGKILL);
+#endif
+	stats.commandsKilled.add();
+	if (killedFor == ProcessEnd::TimedOut) {
+		stats.commandsTimedOut.add();
+	}
+}
+
+ProcessEnd Process::run(const std::string& cmd, const ProcessOptions& options, ProcessOutput& output)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (killedFor != ProcessEnd::Exited) {
+			finished = true;
+			return killedFor;
+		}
+	}
+	stats.commandsRun.add();
+#ifdef _WIN32
+	// Inheritable write end for the child, the read end stays here
+	SECURITY_ATTRIBUTES sa = {
+		.nLength = sizeof(SECURITY_ATTRIBUTES),
+		.bInheritHandle = TRUE,
+	};
+	HANDLE readPipe, writePipe;
+	if (!CreatePipe(&readPipe, &writePipe, &sa, 0)) {
+		return ProcessEnd::FailedToStart;
+	}
+	SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+	// Started suspended so it's in the job before it can spawn anything
+	HANDLE newJob = CreateJobObjectA(NULL, NULL);
+	PROCESS_INFORMATION pi;
+	STARTUPINFOA si = {
+		.cb = sizeof(STARTUPINFOA),
+		.dwFlags = STARTF_USESTDHANDLES,
+		.hStdOutput = writePipe,
+		.hStdError = writePipe,
+	};
+	std::string cmdLine = cmd; // CreateProcess may modify it
+	if (!newJob || !CreateProcessA(NULL, cmdLine.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW | CREATE_SUSPENDED,
+			NULL, NULL, &si, &pi)) {
+		if (newJob) {
+			CloseHandle(newJob);
+		}
+		CloseHandle(readPipe);
+		CloseHandle(writePipe);
+		return ProcessEnd::FailedToStart;
+	}
+	AssignProcessToJobObject(newJob, pi.hProcess);
+	ResumeThread(pi.hThread);
+	CloseHandle(pi.hThread);
+	CloseHandle(writePipe);
+#else
+	// Close-on-exec so commands started concurrently don't hold each other's pipes open
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC)) {
+		return ProcessEnd::FailedToStart;
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return ProcessEnd::FailedToStart;
+	}
+	if (pid == 0) {
+		setpgid(0, 0);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		execl("/bin/sh", "sh", "-c", cmd.c_str(), (char*)NULL);
+		_exit(127);
+	}
+	setpgid(pid, pid); // Also here, so a kill right after can't miss the group
+	close(fds[1]);
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+#ifdef _WIN32
+		job = newJob;
+#else
+		pgid = pid;
+#endif
+		running = true;
+		if (killedFor != ProcessEnd::Exited) {
+			killTree(); // Killed while starting
+		}
+	}
+	if (options.timeoutMs) {
+		watchProcess(this, options.timeoutMs);
+	}
+
+	// Read straight into the buffer, one byte past the limit to tell if it was exceeded
+	while (true) {
+		size_t room = PROCESS_READ_SIZE;
+		if (options.maxOutput && options.maxOutput - output.len < room) {
+			room = options.maxOutput - output.len + 1; // Can't wrap around for a huge limit
+		}
+		if (!output.reserve(room)) {
+			kill(ProcessEnd::OutputLimit);
+			break;
+		}
+#ifdef _WIN32
+		DWORD n;
+		if (!ReadFile(readPipe, output.data + output.len, room, &n, NULL) || !n) {
+			break;
+		}
+#else
+		ssize_t n = read(fds[0], output.data + output.len, room);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+#endif
+		output.len += n;
+		if (options.maxOutput && output.len > options.maxOutput) {
+			output.len = options.maxOutput;
+			kill(options.truncate ? ProcessEnd::Truncated : ProcessEnd::OutputLimit);
+			break;
+		}
+	}
+
+#ifdef _WIN32
+	CloseHandle(readPipe);
+	CloseHandle(pi.hProcess);
+#else
+	// Wait without reaping, so the group id can't be reused while it can still be killed
+	close(fds[0]);
+	siginfo_t info;
+	while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR);
+#endif
+	if (options.timeoutMs) {
+		unwatchProcess(this);
+	}
+	ProcessEnd end;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+		finished = true;
+		end = killedFor;
+	}
+#ifdef _WIN32
+	CloseHandle(job);
+	job = nullptr;
+#else
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+	pgid = -1;
+#endif
+	return end;
+}
+
+const char *processEndError(ProcessEnd end)
+{
+	switch (end) {
+	case ProcessEnd::Exited:
+	case ProcessEnd::Truncated:
+		return nullptr;
+	case ProcessEnd::FailedToStart: return "failed to run command";
+	case ProcessEnd::TimedOut: return "command timed out";
+	case ProcessEnd::OutputLimit: return "command output exceeded the limit";
+	case ProcessEnd::Cancelled: return "command cancelled";
+	}
+	return nullptr;
+}
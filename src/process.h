@@ -0,0 +1,58 @@
+#pragma once
+
+// Runs a command and collects its output, with limits that kill the whole process tree
+//
+// The tree is a job object on Windows and a process group on POSIX, so grandchildren spawned by a
+// shell go down with it. Deadlines are enforced by one shared watchdog thread.
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Output read straight into a malloc'd buffer, so it can be handed over without a copy
+struct ProcessOutput {
+	uint8_t *data = nullptr;
+	size_t len = 0, cap = 0;
+
+	~ProcessOutput();
+
+	// Makes room for at least `n` more bytes after `len`
+	bool reserve(size_t n);
+
+	// Gives up the buffer, trimmed to its length, to be released with free()
+	uint8_t *release();
+};
+
+struct ProcessOptions {
+	uint32_t timeoutMs = 0; // 0 for none
+	size_t maxOutput = 0; // 0 for no limit
+	bool truncate = false; // Past `maxOutput`, keep what fits and end the command instead of failing
+};
+
+enum class ProcessEnd { Exited, FailedToStart, TimedOut, OutputLimit, Truncated, Cancelled };
+
+class Process {
+	std::mutex mutex; // Guards the handles against `kill` from other threads
+	bool running = false, finished = false;
+	ProcessEnd killedFor = ProcessEnd::Exited;
+#ifdef _WIN32
+	void *job = nullptr;
+#else
+	int pgid = -1;
+#endif
+
+	void killTree();
+
+public:
+	// Runs `cmd` and reads its stdout and stderr until they close or a limit trips, blocking.
+	// Single use.
+	ProcessEnd run(const std::string& cmd, const ProcessOptions& options, ProcessOutput& output);
+
+	// Kills the tree from any thread, making `run` return `reason` if it wasn't done yet.
+	// Before `run` it stops the command from starting at all.
+	void kill(ProcessEnd reason);
+};
+
+// Message for a failed run, null if it counts as a success
+const char *processEndError(ProcessEnd end);
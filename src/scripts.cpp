@@ -0,0 +1,55 @@
+#include "scripts.h"
+#include "log.h"
+
+ScriptInfo scriptInfos[WBLOCKS_MAX_SCRIPTS];
+std::atomic<uint32_t> scriptCount = 1;
+uint32_t currentScript = SCRIPT_LIB;
+uint64_t callbackStartUs;
+uint64_t callbackBudgetUs = 500 * 1000;
+
+static struct ScriptsInit {
+	ScriptsInit() {
+		scriptInfos[SCRIPT_LIB].name = "<lib>";
+	}
+} scriptsInit;
+
+uint32_t registerScript(const std::string& name)
+{
+	uint32_t id = scriptCount.load(std::memory_order_relaxed);
+	if (id >= WBLOCKS_MAX_SCRIPTS) {
+		return SCRIPT_LIB;
+	}
+	scriptInfos[id].name = name;
+	scriptCount.store(id + 1, std::memory_order_release);
+	return id;
+}
+
+bool checkScriptBudget()
+{
+	uint64_t now = nowUs();
+	uint64_t elapsed = now - callbackStartUs;
+	if (elapsed < callbackBudgetUs) {
+		return false;
+	}
+
+	ScriptInfo& info = scriptInfos[currentScript];
+	info.overruns.fetch_add(1, std::memory_order_relaxed);
+	stats.scriptOverruns.add();
+	if (now - info.lastOverrunUs > SCRIPT_STRIKE_WINDOW_US) {
+		info.strikes = 0;
+	}
+	info.strikes++;
+	info.lastOverrunUs = now;
+	logPrintf(LogLevel::Warn, info.name.c_str(), "interrupted after running for %llu ms",
+			(unsigned long long)(elapsed / 1000));
+	if (currentScript != SCRIPT_LIB && info.strikes >= SCRIPT_MAX_STRIKES && !info.disabled) {
+		info.disabled = true;
+		stats.scriptsDisabled.add();
+		logPrintf(LogLevel::Error, info.name.c_str(), "disabled after %d interrupts within %d seconds",
+				SCRIPT_MAX_STRIKES, SCRIPT_STRIKE_WINDOW_US / 1000000);
+	}
+
+	// The interrupt unwinds past any `finally` that would restore the script
+	enterScript(SCRIPT_LIB);
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Registry of loaded block scripts, used to attribute resource use to them
+
+#include "stats.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define WBLOCKS_MAX_SCRIPTS 256
+#define SCRIPT_LIB 0 // lib.mjs and anything that can't be attributed
+#define SCRIPT_MAX_STRIKES 3 // Budget overruns within the window that disable a script
+#define SCRIPT_STRIKE_WINDOW_US (60 * 1000 * 1000)
+
+struct ScriptInfo {
+	std::string name;
+	std::atomic<int64_t> heapBytes{0};
+	std::atomic<uint64_t> heapAllocs{0};
+	std::atomic<uint64_t> overruns{0};
+	std::atomic<bool> disabled{false}; // Its callbacks are skipped
+
+	// Only touched on the JS thread
+	uint32_t strikes = 0;
+	uint64_t lastOverrunUs = 0;
+};
+
+extern ScriptInfo scriptInfos[WBLOCKS_MAX_SCRIPTS];
+extern std::atomic<uint32_t> scriptCount;
+
+// The script currently running on the JS thread, only touched there
+extern uint32_t currentScript;
+
+// When the running callback started and how long it may take, only touched on the JS thread
+extern uint64_t callbackStartUs;
+extern uint64_t callbackBudgetUs;
+
+// Returns the new id, or SCRIPT_LIB if there are too many scripts
+uint32_t registerScript(const std::string& name);
+
+// Returns the previous script, switching scripts starts a new budget
+static inline uint32_t enterScript(uint32_t id)
+{
+	uint32_t prev = currentScript;
+	currentScript = id < scriptCount.load(std::memory_order_relaxed) ? id : SCRIPT_LIB;
+	callbackStartUs = nowUs();
+	return prev;
+}
+
+static inline bool scriptDisabled(uint32_t id)
+{
+	return scriptInfos[id].disabled.load(std::memory_order_relaxed);
+}
+
+// For the interrupt handler, returns true if the current callback ran past its budget and should be
+// interrupted. Logs it and disables scripts that keep doing it.
+bool checkScriptBudget();
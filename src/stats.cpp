@@ -0,0 +1,80 @@
+#include "stats.h"
+#include "scripts.h"
+
+#include <cstdio>
+
+Stats stats;
+
+static void formatCounter(std::string& out, const char *name, const Counter& counter)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%s: %llu\n", name, (unsigned long long)counter.value.load());
+	out += line;
+}
+
+static void formatGauge(std::string& out, const char *name, const Gauge& gauge)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%s: %lld\n", name, (long long)gauge.value.load());
+	out += line;
+}
+
+static void formatLatency(std::string& out, const char *name, const LatencyStat& stat)
+{
+	uint64_t count = stat.count.load();
+	char line[128];
+	snprintf(line, sizeof(line), "%s: avg %.1f ms, max %.1f ms (%llu samples)\n", name,
+			count ? stat.totalUs.load() / 1000.0 / count : 0.0, stat.maxUs.load() / 1000.0,
+			(unsigned long long)count);
+	out += line;
+}
+
+std::string formatStats()
+{
+	std::string out;
+	formatCounter(out, "Input events", stats.inputEvents);
+	formatLatency(out, "Input latency", stats.inputLatency);
+	formatCounter(out, "Log lines dropped", stats.logDropped);
+	formatCounter(out, "Log lines suppressed", stats.logSuppressed);
+	formatGauge(out, "JS heap bytes", stats.jsHeapBytes);
+	formatGauge(out, "JS heap peak bytes", stats.jsHeapPeak);
+	formatGauge(out, "JS heap limit bytes", stats.jsHeapLimit);
+	formatGauge(out, "JS objects", stats.jsObjects);
+	formatGauge(out, "JS strings", stats.jsStrings);
+	formatCounter(out, "Image decodes", stats.imageDecodes);
+	formatCounter(out, "Image cache hits", stats.imageCacheHits);
+	formatLatency(out, "JSON parse", stats.jsonParse);
+	formatLatency(out, "JSON materialize", stats.jsonMaterialize);
+	formatCounter(out, "Commands run", stats.commandsRun);
+	formatCounter(out, "Commands timed out", stats.commandsTimedOut);
+	formatCounter(out, "Commands killed", stats.commandsKilled);
+	formatLatency(out, "Shell resolve", stats.shellResolve);
+	formatLatency(out, "Native block tick", stats.nativeBlockTick);
+	formatCounter(out, "Native block failures", stats.nativeBlockFailures);
+	formatCounter(out, "Script overruns", stats.scriptOverruns);
+	formatCounter(out, "Scripts disabled", stats.scriptsDisabled);
+	formatCounter(out, "IPC messages", stats.ipcMessages);
+	formatCounter(out, "IPC batches", stats.ipcBatches);
+	formatCounter(out, "IPC clients rejected", stats.ipcRejected);
+	formatCounter(out, "IPC updates dropped", stats.ipcDropped);
+	formatCounter(out, "Trace events", stats.traceEvents);
+	formatCounter(out, "Trace events dropped", stats.traceDropped);
+	formatCounter(out, "Bar surfaces drawn", stats.barSurfacesDrawn);
+	formatCounter(out, "Bar surfaces skipped", stats.barSurfacesSkipped);
+	formatCounter(out, "Bar presents", stats.barPresents);
+	formatCounter(out, "Visibility changes", stats.visibilityChanges);
+	formatCounter(out, "Frames deferred while hidden", stats.framesDeferred);
+	formatCounter(out, "Catch up frames", stats.catchUpFrames);
+	formatLatency(out, "Animation frames", stats.animationFrames);
+	formatCounter(out, "Animated regions drawn", stats.animatedRegionsDrawn);
+
+	out += "\nPer script:\n";
+	for (uint32_t i = 0; i < scriptCount.load(std::memory_order_acquire); i++) {
+		char line[512];
+		snprintf(line, sizeof(line), "  %s: %lld bytes in %llu allocations, %llu overruns%s\n", scriptInfos[i].name.c_str(),
+				(long long)scriptInfos[i].heapBytes.load(), (unsigned long long)scriptInfos[i].heapAllocs.load(),
+				(unsigned long long)scriptInfos[i].overruns.load(), scriptInfos[i].disabled ? " (disabled)" : "");
+		out += line;
+	}
+	return out;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Process-wide counters, readable from any thread
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+static inline uint64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Counter {
+	std::atomic<uint64_t> value{0};
+
+	void add(uint64_t n = 1) {
+		value.fetch_add(n, std::memory_order_relaxed);
+	}
+};
+
+struct Gauge {
+	std::atomic<int64_t> value{0};
+
+	void set(int64_t v) {
+		value.store(v, std::memory_order_relaxed);
+	}
+};
+
+struct LatencyStat {
+	std::atomic<uint64_t> count{0}, totalUs{0}, maxUs{0};
+
+	void record(uint64_t us) {
+		count.fetch_add(1, std::memory_order_relaxed);
+		totalUs.fetch_add(us, std::memory_order_relaxed);
+		uint64_t prev = maxUs.load(std::memory_order_relaxed);
+		while (us > prev && !maxUs.compare_exchange_weak(prev, us, std::memory_order_relaxed));
+	}
+};
+
+struct Stats {
+	Counter inputEvents;
+	LatencyStat inputLatency; // From the window message to the JS handler being called
+	Counter logDropped; // Ring was full
+	Counter logSuppressed; // Rate limited
+	Gauge jsHeapBytes, jsHeapPeak, jsHeapLimit; // Sampled periodically on the JS thread
+	Gauge jsObjects, jsStrings;
+	Counter imageDecodes, imageCacheHits;
+	LatencyStat jsonParse; // Of `$json` output, on the command's thread
+	LatencyStat jsonMaterialize; // Turning the parsed tree into JS values, on the JS thread
+	Counter commandsRun, commandsTimedOut;
+	LatencyStat shellResolve; // Settling a `$` Promise on the JS thread, with the continuations it runs
+	LatencyStat nativeBlockTick; // The same for a `.block` block, from its command's output to the block updated
+	Counter nativeBlockFailures; // Command failed or its output didn't match
+	Counter commandsKilled; // For a timeout, output limit or cancellation
+	Counter scriptOverruns; // Callbacks interrupted for running past their budget
+	Counter scriptsDisabled;
+	Counter ipcMessages, ipcBatches; // Block updates pushed through the IPC endpoint
+	Counter ipcRejected; // Clients dropped for malformed frames
+	Counter ipcDropped; // Updates to new names once the most pushed blocks were made
+	Counter traceEvents, traceDropped; // Recorded, and lost because writing fell behind
+	Counter barSurfacesDrawn, barPresents; // Presents past the surfaces drawn are bars sharing one
+	Counter barSurfacesSkipped; // Left as they were by an update that didn't change them
+	Counter visibilityChanges;
+	Counter framesDeferred; // Changes not drawn while the bar couldn't be seen
+	Counter catchUpFrames; // Drawn for them once it could
+	LatencyStat animationFrames; // Redrawing and presenting the regions of animated blocks that moved
+	Counter animatedRegionsDrawn; // Blocks redrawn by those frames, per surface
+};
+extern Stats stats;
+
+// Human readable dump of all stats, one per line
+std::string formatStats();
@@ -0,0 +1,196 @@
+#include "trace.h"
+#include "stats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#define TRACE_FLUSH_BYTES (256 * 1024) // Wakes the writer early
+#define TRACE_FLUSH_MS 100
+#define TRACE_MAX_PENDING (16 * 1024 * 1024) // Past this the disk can't keep up and records are dropped
+
+std::atomic<bool> traceActive;
+
+// Leaked so recording from other threads can't outlive it
+struct TraceState {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::string buf;
+	uint64_t lastUs = 0;
+	FILE *file = nullptr; // Only written to by the writer thread while it runs
+	std::thread writer;
+	bool stopping = false;
+};
+static TraceState& state = *new TraceState();
+
+static void putVarint(std::string& out, uint64_t v)
+{
+	while (v >= 0x80) {
+		out += (char)(v | 0x80);
+		v >>= 7;
+	}
+	out += (char)v;
+}
+
+static void writerThreadFn()
+{
+	std::string out;
+	std::unique_lock<std::mutex> lock(state.mutex);
+	while (true) {
+		state.wake.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_MS),
+				[] { return state.stopping || state.buf.size() >= TRACE_FLUSH_BYTES; });
+		out.swap(state.buf);
+		bool stop = state.stopping;
+		lock.unlock();
+		fwrite(out.data(), 1, out.size(), state.file);
+		out.clear();
+		if (stop) {
+			return;
+		}
+		lock.lock();
+	}
+}
+
+bool traceStart(const std::string& path, std::string& err)
+{
+	std::lock_guard<std::mutex> lock(state.mutex);
+	if (state.file) {
+		err = "already recording";
+		return false;
+	}
+	state.file = fopen(path.c_str(), "wb");
+	if (!state.file) {
+		err = "failed to open " + path;
+		return false;
+	}
+
+	uint64_t startUs = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	state.buf.assign(TRACE_MAGIC, 8);
+	for (int i = 0; i < 8; i++) {
+		state.buf += (char)(startUs >> (i * 8));
+	}
+	state.lastUs = nowUs();
+	state.stopping = false;
+	state.writer = std::thread(writerThreadFn);
+	traceActive.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void traceStop()
+{
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		if (!state.file) {
+			return;
+		}
+		traceActive.store(false, std::memory_order_relaxed);
+		state.stopping = true;
+	}
+	state.wake.notify_one();
+	state.writer.join();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	fclose(state.file);
+	state.file = nullptr;
+}
+
+void traceWrite(TraceOp op, uint64_t id, const int64_t *ints, size_t count, std::string_view str)
+{
+	bool wake;
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		if (!traceActive.load(std::memory_order_relaxed)) {
+			return; // Stopped since the caller checked
+		}
+		if (state.buf.size() >= TRACE_MAX_PENDING) {
+			stats.traceDropped.add();
+			return;
+		}
+
+		// Taken under the lock so deltas never go negative across threads
+		uint64_t now = nowUs();
+		state.buf += (char)op;
+		putVarint(state.buf, now - state.lastUs);
+		state.lastUs = now;
+		putVarint(state.buf, id);
+		putVarint(state.buf, count);
+		for (size_t i = 0; i < count; i++) {
+			putVarint(state.buf, ((uint64_t)ints[i] << 1) ^ (uint64_t)(ints[i] >> 63));
+		}
+		putVarint(state.buf, str.size());
+		state.buf += str;
+		wake = state.buf.size() >= TRACE_FLUSH_BYTES;
+	}
+	stats.traceEvents.add();
+	if (wake) {
+		state.wake.notify_one();
+	}
+}
+
+bool TraceReader::varint(uint64_t& out)
+{
+	out = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (pos == end) {
+			return false;
+		}
+		uint8_t b = *pos++;
+		out |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TraceReader::open(const uint8_t *data, size_t len)
+{
+	if (len < 16 || memcmp(data, TRACE_MAGIC, 8)) {
+		return false;
+	}
+	startUs = 0;
+	for (int i = 0; i < 8; i++) {
+		startUs |= (uint64_t)data[8 + i] << (i * 8);
+	}
+	pos = data + 16;
+	end = data + len;
+	time = 0;
+	return true;
+}
+
+bool TraceReader::next(TraceEvent& ev)
+{
+	// A partial record is left unread so `done` tells it apart from the end
+	const uint8_t *start = pos;
+	auto fail = [&] {
+		pos = start;
+		return false;
+	};
+	uint64_t delta, count, len;
+	if (pos == end) {
+		return false;
+	}
+	ev.op = (TraceOp)*pos++;
+	if (!varint(delta) || !varint(ev.id) || !varint(count) || count > (size_t)(end - pos)) {
+		return fail();
+	}
+	ev.ints.resize(count);
+	for (int64_t& i : ev.ints) {
+		uint64_t v;
+		if (!varint(v)) {
+			return fail();
+		}
+		i = (int64_t)((v >> 1) ^ -(v & 1));
+	}
+	if (!varint(len) || len > (size_t)(end - pos)) {
+		return fail();
+	}
+	ev.str.assign((const char*)pos, len);
+	pos += len;
+	time += delta;
+	ev.timeUs = time;
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// Opt-in binary recording of everything that changes the blocks or the bar, to be replayed elsewhere
+//
+// A trace is "WBTRACE1", the start as u64 microseconds since the epoch, then records of
+//   u8 op, varint microseconds since the previous record, varint id,
+//   varint count, that many zigzag varints, varint length, that many bytes of string
+// Ids are blocks (0 for `defaultBlock`) for block ops, bars for drawing ops and jobs for shell ops. Recording appends to a
+// buffer under a lock, a background thread writes it out.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define TRACE_MAGIC "WBTRACE1"
+
+enum class TraceOp : uint8_t {
+	Create = 1, // Copy of the block in ints[0]
+	Remove,
+	Text, // str
+	Segments, // ints[0] segments, their text joined in str
+	Font, // ints[0] size, str name
+	Color, // COLORREF
+	Padding, // Left, right
+	Visible,
+	Group, // LayoutGroup
+	Width, // Min, max
+	Priority,
+	Overflow, // LayoutOverflow
+	Separator,
+	Interactive,
+	Image, // Width, height, 0 for none
+	Graph, // Columns, height, min and max as float bits, 0 columns for none
+	Samples, // Float bits of each sample committed
+	Measure, // Text width in pixels
+	Redraw, // Width, height, microseconds taken, DPI of a surface, for its first bar
+	Present, // Microseconds taken by all the bars of the surface last redrawn
+	ShellStart, // str command
+	ShellExit, // ProcessEnd, output bytes
+	ShellResolve, // Microseconds taken
+	Bars, // BarMask
+	Animation, // AnimationKind, marquee speed and gap, period in milliseconds, min alpha
+	Animate, // Regions redrawn and microseconds taken by an animation frame, for the first bar
+};
+
+extern std::atomic<bool> traceActive;
+
+// Starts recording to `path`, replacing it
+bool traceStart(const std::string& path, std::string& err);
+
+// Writes out what is buffered and closes the trace
+void traceStop();
+
+void traceWrite(TraceOp op, uint64_t id, const int64_t *ints, size_t count, std::string_view str);
+
+static inline void trace(TraceOp op, uint64_t id, std::initializer_list<int64_t> ints = {}, std::string_view str = {})
+{
+	if (traceActive.load(std::memory_order_relaxed)) {
+		traceWrite(op, id, ints.begin(), ints.size(), str);
+	}
+}
+
+struct TraceEvent {
+	TraceOp op;
+	uint64_t timeUs; // Since the start of the trace
+	uint64_t id;
+	std::vector<int64_t> ints;
+	std::string str;
+
+	int64_t arg(size_t i) const {
+		return i < ints.size() ? ints[i] : 0;
+	}
+};
+
+class TraceReader {
+	const uint8_t *pos = nullptr, *end = nullptr;
+	uint64_t time = 0;
+
+	bool varint(uint64_t& out);
+
+public:
+	uint64_t startUs = 0; // Since the epoch
+
+	// False if `data` isn't a trace
+	bool open(const uint8_t *data, size_t len);
+
+	// False at the end, or where the rest is cut off or malformed
+	bool next(TraceEvent& ev);
+
+	bool done() const {
+		return pos == end;
+	}
+};
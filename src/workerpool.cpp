@@ -0,0 +1,32 @@
+#include "workerpool.h"
+
+#include <thread>
+
+WorkerPool::WorkerPool(size_t threads)
+{
+	for (size_t i = 0; i < threads; i++) {
+		std::thread(&WorkerPool::threadFn, this).detach();
+	}
+}
+
+void WorkerPool::threadFn()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return !jobs.empty(); });
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+void WorkerPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	wake.notify_one();
+}
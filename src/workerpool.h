@@ -0,0 +1,23 @@
+#pragma once
+
+// Fixed set of threads running queued jobs in order of submission
+//
+// Threads are detached and the pool is never torn down, it lives as long as the process.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class WorkerPool {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> jobs;
+
+	void threadFn();
+
+public:
+	WorkerPool(size_t threads);
+
+	void submit(std::function<void()> job);
+};
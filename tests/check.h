@@ -0,0 +1,22 @@
+#pragma once
+
+// Minimal checks for the native tests of the portable parts, run by `make test`
+//
+// A failed check is reported with its line and the test carries on, `checkDone` gives the exit status.
+
+#include <cstdio>
+
+static int checkFailures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		checkFailures++; \
+	} \
+} while (0)
+
+static inline int checkDone(const char *name)
+{
+	printf("%s: %s\n", name, checkFailures ? "FAILED" : "ok");
+	return checkFailures ? 1 : 0;
+}
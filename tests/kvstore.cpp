@@ -0,0 +1,130 @@
+// KVStore on the POSIX backend: persistence, overwrites, deletes, expiry, torn records and compaction
+
+#include "check.h"
+#include "kvstore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#define TEST_KV_PATH "test_kvstore.kv"
+
+static std::string getString(KVStore& kv, const std::string& key)
+{
+	KVStore::Value value;
+	return kv.get(key, value) ? std::string(value.data, value.len) : "<missing>";
+}
+
+static int64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void testPersistence()
+{
+	remove(TEST_KV_PATH);
+	{
+		KVStore kv;
+		CHECK(kv.open(TEST_KV_PATH, 4096));
+		CHECK(kv.set("a", "hello", 5, false, 0));
+		CHECK(kv.set("bin", "\0\1\2", 3, true, 0));
+		CHECK(kv.set("a", "world!", 6, false, 0));
+		CHECK(kv.set("gone", "x", 1, false, 0));
+		CHECK(kv.remove("gone"));
+		CHECK(!kv.remove("never"));
+		CHECK(kv.set("expired", "x", 1, false, nowMs() - 1));
+		CHECK(kv.set("later", "x", 1, false, nowMs() + 3600 * 1000));
+	}
+	KVStore kv;
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	CHECK(getString(kv, "a") == "world!");
+	KVStore::Value value;
+	CHECK(kv.get("bin", value) && value.binary && value.len == 3 && !memcmp(value.data, "\0\1\2", 3));
+	CHECK(getString(kv, "gone") == "<missing>");
+	CHECK(getString(kv, "expired") == "<missing>");
+	CHECK(getString(kv, "later") == "x");
+}
+
+// A record cut off by a crash is dropped along with anything after it, the rest survives
+static void testTornRecord()
+{
+	remove(TEST_KV_PATH);
+	{
+		KVStore kv;
+		CHECK(kv.open(TEST_KV_PATH, 4096));
+		CHECK(kv.set("kept", "1", 1, false, 0));
+		CHECK(kv.set("torn", "2", 1, false, 0));
+	}
+	FILE *f = fopen(TEST_KV_PATH, "r+b");
+	CHECK(f);
+	if (f) {
+		// Flip a byte of the second record's value, its checksum no longer matches
+		char buf[4096];
+		size_t n = fread(buf, 1, sizeof(buf), f);
+		char *last = (char*)memmem(buf, n, "torn2", 5);
+		CHECK(last);
+		if (last) {
+			fseek(f, last + 4 - buf, SEEK_SET);
+			fputc('X', f);
+		}
+		fclose(f);
+	}
+	KVStore kv;
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	CHECK(getString(kv, "kept") == "1");
+	CHECK(getString(kv, "torn") == "<missing>");
+	CHECK(kv.set("after", "3", 1, false, 0));
+	CHECK(getString(kv, "after") == "3");
+}
+
+// Filling a small file many times over compacts it, keeping the latest value of every key
+static void testCompaction()
+{
+	remove(TEST_KV_PATH);
+	KVStore kv;
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	char key[32], value[64];
+	for (int i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "k%d", i % 50);
+		snprintf(value, sizeof(value), "value %d", i);
+		CHECK(kv.set(key, value, strlen(value), false, 0));
+	}
+	CHECK(kv.size() == 50);
+	kv.close();
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	CHECK(kv.size() == 50);
+	CHECK(getString(kv, "k7") == "value 4957");
+}
+
+// Removing a key that expired while the file is full compacts it away first
+static void testRemoveExpiredWhenFull()
+{
+	remove(TEST_KV_PATH);
+	KVStore kv;
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	CHECK(kv.set("expired", "x", 1, false, nowMs() - 1));
+
+	// Records are 32 bytes plus key and value, 8 byte aligned: 16 of header and 40 leave 4040 to fill exactly
+	std::string fill(4040 - 32 - 4, 'f');
+	CHECK(kv.set("fill", fill.data(), fill.size(), false, 0));
+	CHECK(!kv.remove("expired"));
+	CHECK(kv.size() == 1);
+	CHECK(getString(kv, "fill") == fill);
+	CHECK(kv.remove("fill"));
+	kv.close();
+	CHECK(kv.open(TEST_KV_PATH, 4096));
+	CHECK(kv.size() == 0);
+}
+
+int main()
+{
+	testPersistence();
+	testTornRecord();
+	testCompaction();
+	testRemoveExpiredWhenFull();
+	remove(TEST_KV_PATH);
+	remove(TEST_KV_PATH ".tmp");
+	return checkDone("kvstore");
+}
@@ -0,0 +1,105 @@
+// computeLayout and HitIndex: width limits, ellipsizing and hiding on overflow, placement and hit testing
+
+#include "check.h"
+#include "layout.h"
+
+#define TEST_SEPARATOR_WIDTH 9
+
+static LayoutItem item(int width, LayoutOverflow overflow = LayoutOverflow::Hide, int priority = 0)
+{
+	return { .width = width, .padLeft = 2, .padRight = 2, .priority = priority, .overflow = overflow };
+}
+
+static void testWidthLimits()
+{
+	std::vector<LayoutItem> items = { item(100), item(10), item(50) };
+	items[0].maxWidth = 60;
+	items[1].minWidth = 30;
+	Layout layout;
+	computeLayout(items, 1000, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(layout.spans[0].contentWidth == 60 && layout.spans[0].ellipsized);
+	CHECK(layout.spans[1].contentWidth == 30 && !layout.spans[1].ellipsized);
+	CHECK(layout.spans[2].contentWidth == 50 && layout.spans[2].width == 54);
+
+	// Right aligned, in order and touching
+	CHECK(layout.spans[2].x + layout.spans[2].width == 1000);
+	CHECK(layout.spans[1].x + layout.spans[1].width == layout.spans[2].x);
+	CHECK(layout.spans[0].x + layout.spans[0].width == layout.spans[1].x);
+}
+
+static void testEllipsize()
+{
+	// 104 + 54 wide in 120, the ellipsizable block gives way first and gives up the 38 over
+	std::vector<LayoutItem> items = { item(100, LayoutOverflow::Ellipsize), item(50, LayoutOverflow::Hide, 1) };
+	Layout layout;
+	computeLayout(items, 120, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(layout.spans[0].shown && layout.spans[0].ellipsized);
+	CHECK(layout.spans[0].contentWidth == 62);
+	CHECK(layout.spans[1].shown && layout.spans[1].contentWidth == 50);
+
+	// Not below its minimum, the next block gives way instead
+	items[0].minWidth = 80;
+	computeLayout(items, 120, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(layout.spans[0].shown && layout.spans[0].contentWidth == 80);
+	CHECK(!layout.spans[1].shown && layout.spans[1].width == 0);
+
+	// Hidden once nothing else can
+	computeLayout({ items[0] }, 60, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(!layout.spans[0].shown);
+
+	// A negative minimum counts as 0 rather than cutting past the content
+	items[0].minWidth = -50;
+	computeLayout(items, 30, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(layout.spans[0].contentWidth >= 0 && layout.spans[0].width >= 0);
+}
+
+static void testPriority()
+{
+	// Lowest priority goes first, later blocks before earlier ones at the same priority
+	std::vector<LayoutItem> items = { item(50, LayoutOverflow::Hide, 1), item(50), item(50) };
+	Layout layout;
+	computeLayout(items, 120, TEST_SEPARATOR_WIDTH, layout);
+	CHECK(layout.spans[0].shown);
+	CHECK(layout.spans[1].shown);
+	CHECK(!layout.spans[2].shown);
+}
+
+static void testHitIndex()
+{
+	std::vector<LayoutItem> items = { item(20), item(30), item(40) };
+	items[0].group = LayoutGroup::Left;
+	items[1].visible = false;
+	Layout layout;
+	computeLayout(items, 200, TEST_SEPARATOR_WIDTH, layout);
+	HitIndex hits;
+	hits.build(layout);
+	CHECK(hits.find(0) == 0);
+	CHECK(hits.find(23) == 0);
+	CHECK(hits.find(24) == -1);
+	CHECK(hits.find(200 - 44) == 2);
+	CHECK(hits.find(199) == 2);
+	CHECK(hits.find(200) == -1);
+	CHECK(hits.find(-1) == -1);
+}
+
+static void testEngine()
+{
+	std::vector<LayoutItem> items = { item(20), item(30) };
+	LayoutEngine engine(TEST_SEPARATOR_WIDTH);
+	CHECK(engine.update(items, 200));
+	CHECK(!engine.update(items, 200));
+	items[1].width = 31;
+	CHECK(engine.update(items, 200));
+	CHECK(engine.get().spans[1].contentWidth == 31);
+	CHECK(engine.update(items, 150));
+}
+
+int main()
+{
+	testWidthLimits();
+	testEllipsize();
+	testPriority();
+	testHitIndex();
+	testEngine();
+	return checkDone("layout");
+}
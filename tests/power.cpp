@@ -0,0 +1,89 @@
+// PowerPolicy driven by a fake visibility source: polling, held back frames, catch up and timer stretch
+
+#include "check.h"
+#include "power.h"
+#include "stats.h"
+
+#include <limits>
+
+class FakeVisibility : public VisibilitySource {
+public:
+	Visibility visibility = Visibility::Visible;
+	int polls = 0;
+
+	Visibility poll() override {
+		polls++;
+		return visibility;
+	}
+};
+
+static void testPolling()
+{
+	FakeVisibility source;
+	PowerPolicy power(source, 4, 100);
+	CHECK(!power.update(0));
+	CHECK(source.polls == 1);
+	source.visibility = Visibility::Hidden;
+	CHECK(!power.update(50000)); // Not due yet
+	CHECK(source.polls == 1);
+	CHECK(power.update(100000));
+	CHECK(!power.visible());
+	source.visibility = Visibility::Locked;
+	CHECK(power.update(200000));
+	CHECK(power.current() == Visibility::Locked);
+	CHECK(!power.update(300000)); // Unchanged
+}
+
+static void testDeferredFrames()
+{
+	FakeVisibility source;
+	PowerPolicy power(source, 4, 100);
+	power.update(0);
+	CHECK(power.shouldDraw(true));
+	CHECK(!power.shouldDraw(false));
+
+	uint64_t deferred = stats.framesDeferred.value.load();
+	uint64_t catchUp = stats.catchUpFrames.value.load();
+	source.visibility = Visibility::Hidden;
+	power.update(100000);
+	CHECK(!power.shouldDraw(true));
+	CHECK(!power.shouldDraw(true));
+	CHECK(!power.shouldDraw(false));
+	CHECK(stats.framesDeferred.value.load() == deferred + 2);
+
+	source.visibility = Visibility::Visible;
+	power.update(200000);
+	CHECK(power.shouldDraw(false)); // Held back frames drawn as one
+	CHECK(!power.shouldDraw(false));
+	CHECK(stats.catchUpFrames.value.load() == catchUp + 1);
+}
+
+static void testTimerStretch()
+{
+	FakeVisibility source;
+	PowerPolicy power(source, 4, 100);
+	power.update(0);
+	CHECK(power.timerStretch() == 1);
+	source.visibility = Visibility::Hidden;
+	power.update(100000);
+	CHECK(power.timerStretch() == 4);
+
+	power.setTimerStretch(0.5);
+	CHECK(power.timerStretch() == 1);
+	power.setTimerStretch(std::numeric_limits<double>::quiet_NaN());
+	CHECK(power.timerStretch() == 1);
+	power.setTimerStretch(std::numeric_limits<double>::infinity());
+	CHECK(power.timerStretch() == POWER_MAX_TIMER_STRETCH);
+
+	PowerPolicy unbounded(source, 1e300, 100);
+	unbounded.update(0);
+	CHECK(unbounded.timerStretch() == POWER_MAX_TIMER_STRETCH);
+}
+
+int main()
+{
+	testPolling();
+	testDeferredFrames();
+	testTimerStretch();
+	return checkDone("power");
+}
@@ -0,0 +1,116 @@
+// Process on the POSIX backend: output, timeout, output limit, cancellation and killing the whole group
+
+#include "check.h"
+#include "process.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#define TEST_PROCESS_TICKS "test_process.ticks"
+
+static ProcessEnd run(const std::string& cmd, const ProcessOptions& options, std::string& out)
+{
+	Process process;
+	ProcessOutput output;
+	ProcessEnd end = process.run(cmd, options, output);
+	out.assign((const char*)output.data, output.len);
+	return end;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long fileSize(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+static void testOutput()
+{
+	std::string out;
+	CHECK(run("echo out; echo err >&2", {}, out) == ProcessEnd::Exited);
+	CHECK(out == "out\nerr\n");
+	CHECK(run("exit 3", {}, out) == ProcessEnd::Exited); // The exit code isn't a failure
+}
+
+static void testTimeout()
+{
+	std::string out;
+	auto start = std::chrono::steady_clock::now();
+	CHECK(run("echo started; sleep 3", { .timeoutMs = 200 }, out) == ProcessEnd::TimedOut);
+	CHECK(secondsSince(start) < 2);
+	CHECK(out == "started\n");
+	CHECK(run("echo quick", { .timeoutMs = 5000 }, out) == ProcessEnd::Exited);
+}
+
+static void testOutputLimit()
+{
+	std::string out;
+	auto start = std::chrono::steady_clock::now();
+	CHECK(run("yes", { .maxOutput = 10000 }, out) == ProcessEnd::OutputLimit);
+	CHECK(out.size() == 10000);
+	CHECK(run("yes", { .maxOutput = 5, .truncate = true }, out) == ProcessEnd::Truncated);
+	CHECK(out == "y\ny\ny");
+	CHECK(secondsSince(start) < 2);
+	CHECK(run("printf 12345", { .maxOutput = 5 }, out) == ProcessEnd::Exited); // Exactly at the limit
+	CHECK(out == "12345");
+	CHECK(run("printf 12345", { .maxOutput = SIZE_MAX }, out) == ProcessEnd::Exited);
+	CHECK(out == "12345");
+}
+
+static void testCancel()
+{
+	Process process;
+	ProcessOutput output;
+	auto start = std::chrono::steady_clock::now();
+	std::thread canceller([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		process.kill(ProcessEnd::Cancelled);
+	});
+	CHECK(process.run("sleep 3", {}, output) == ProcessEnd::Cancelled);
+	canceller.join();
+	CHECK(secondsSince(start) < 2);
+
+	// Cancelled before it started, it never runs
+	Process early;
+	early.kill(ProcessEnd::Cancelled);
+	CHECK(early.run("echo ran", {}, output) == ProcessEnd::Cancelled);
+}
+
+static void testGroupKill()
+{
+	// A grandchild the shell leaves behind keeps ticking into a file unless the whole group is killed. It
+	// doesn't hold the output open, so the run ends either way.
+	remove(TEST_PROCESS_TICKS);
+	std::string out;
+	std::string cmd = "(while :; do echo . >> " TEST_PROCESS_TICKS "; sleep 0.02; done) >/dev/null 2>&1 & sleep 3";
+	CHECK(run(cmd, { .timeoutMs = 200 }, out) == ProcessEnd::TimedOut);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	long ticks = fileSize(TEST_PROCESS_TICKS);
+	CHECK(ticks > 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	CHECK(fileSize(TEST_PROCESS_TICKS) == ticks);
+	remove(TEST_PROCESS_TICKS);
+}
+
+int main()
+{
+	testOutput();
+	testTimeout();
+	testOutputLimit();
+	testCancel();
+	testGroupKill();
+	return checkDone("process");
+}
@@ -0,0 +1,16 @@
+// Animated blocks for measuring their cost. Record a trace of a few seconds of this and replay it with
+// wbreplay, or compare "Animation frames" against "Animated regions drawn" in the stats. Set N to 1, 4
+// and 16 for the cost per block.
+const N = 4;
+const blocks = [];
+for (let i = 0; i < N; i++) {
+	const block = createBlock();
+	block.set({
+		text: `Artist ${i} - A title far too long to fit in the space it is given`,
+		width: [0, 120],
+		animation: { type: 'marquee', speed: 40 },
+	});
+	blocks.push(block);
+}
+const alert = createBlock();
+alert.set({ text: 'Alert', color: [255, 80, 80], animation: { type: 'blink', period: 800 } });
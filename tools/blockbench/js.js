@@ -0,0 +1,15 @@
+// JS half of the block benchmark, the same block as native.block
+const block = createBlock();
+setInterval(async () => {
+	const out = await $('cmd /c echo load 42 percent', { timeout: 1000 });
+	const m = /load (\d+)/.exec(out.trim());
+	if (!m) {
+		return;
+	}
+	block.setText(`CPU ${m[1]}%`);
+	if (m[1] > 90) {
+		block.setColor(255, 80, 80);
+	} else {
+		block.setColor(255, 255, 255);
+	}
+}, 1000);
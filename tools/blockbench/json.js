@@ -0,0 +1,27 @@
+// `$json` against `$` and JSON.parse on a large document, logged once at startup. The JS thread time of
+// `$json` is "JSON materialize" in the stats, compare it against the JSON.parse time logged here.
+const N = 20;
+const path = 'jsonbench.json';
+
+const items = [];
+for (let i = 0; i < 5000; i++) {
+	items.push({ id: i, name: `process ${i}`, cpu: i * 0.37, mem: i * 4096, threads: [i & 7, -0, 1e10] });
+}
+const file = std.open(path, 'w');
+file.puts(JSON.stringify({ items }));
+file.close();
+
+(async () => {
+	let parseMs = 0;
+	for (let i = 0; i < N; i++) {
+		const text = await $(`cmd /c type ${path}`);
+		const start = Date.now();
+		JSON.parse(text);
+		parseMs += Date.now() - start;
+	}
+	for (let i = 0; i < N; i++) {
+		await $json(`cmd /c type ${path}`);
+	}
+	console.log(`JSON.parse: ${(parseMs / N).toFixed(2)} ms per document, see "JSON materialize" for $json`);
+	os.remove(path);
+})();
@@ -0,0 +1,27 @@
+// Setter call rate, logged once at startup. Compare a build before and after a change to the bindings.
+const block = createBlock();
+const N = 200000;
+
+function rate(name, fn) {
+	const start = Date.now();
+	for (let i = 0; i < N; i++) {
+		fn(i);
+	}
+	const ms = Math.max(Date.now() - start, 1);
+	console.log(`${name}: ${Math.round(N / ms * 1000)} calls/s`);
+}
+
+rate('setColor ints', i => block.setColor(i & 255, 128, 64));
+rate('setColor doubles', i => block.setColor((i & 255) * 0.5, 128.5, 64.5));
+rate('setText', i => block.setText(i & 1 ? 'CPU 12%' : 'CPU 13%'));
+rate('setText + setColor + setPadding', i => {
+	block.setText(i & 1 ? 'CPU 12%' : 'CPU 13%');
+	block.setColor(i & 255, 128, 64);
+	block.setPadding(4, 4);
+});
+rate('set({text, color, padding})', i => block.set({
+	text: i & 1 ? 'CPU 12%' : 'CPU 13%',
+	color: [i & 255, 128, 64],
+	padding: [4, 4],
+}));
+block.remove();
@@ -0,0 +1,58 @@
+// Times KVStore reads and writes on the POSIX backend, writes including the compactions they trigger
+//
+//   kvbench [COUNT]
+
+#include "kvstore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define KVBENCH_PATH "kvbench.kv"
+#define KVBENCH_KEYS 50
+
+static double nsPer(std::chrono::steady_clock::time_point start, int count)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+int main(int argc, char **argv)
+{
+	int count = argc > 1 ? std::max(atoi(argv[1]), 1) : 200000;
+	remove(KVBENCH_PATH);
+	KVStore kv;
+	if (!kv.open(KVBENCH_PATH, 1024 * 1024)) {
+		fprintf(stderr, "kvbench: can't open %s\n", KVBENCH_PATH);
+		return 1;
+	}
+
+	char key[32];
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "key%d", i % KVBENCH_KEYS);
+		kv.set(key, "0123456789", 10, false, 0);
+	}
+	double setNs = nsPer(start, count);
+
+	KVStore::Value value;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "key%d", i % KVBENCH_KEYS);
+		kv.get(key, value);
+	}
+	double getNs = nsPer(start, count);
+
+	kv.close();
+	start = std::chrono::steady_clock::now();
+	kv.open(KVBENCH_PATH, 1024 * 1024);
+	double openNs = nsPer(start, 1);
+	kv.close();
+	remove(KVBENCH_PATH);
+	remove(KVBENCH_PATH ".tmp");
+
+	printf("%d ops over %d keys: set %.0f ns, get %.0f ns, reopen %.1f us\n", count, KVBENCH_KEYS, setNs, getNs,
+			openNs / 1000);
+	return 0;
+}
@@ -0,0 +1,80 @@
+// Times block layout with a few hundred items: computing it outright, and LayoutEngine::update when nothing
+// changed, when one block's width changed and when the bar was resized
+//
+//   layoutbench [ITEMS [ROUNDS]]
+
+#include "layout.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define LAYOUTBENCH_BAR_WIDTH 1800 // Narrower than the items, so some get ellipsized or hidden
+#define LAYOUTBENCH_SEPARATOR_WIDTH 9
+
+static double nsPer(std::chrono::steady_clock::time_point start, int count)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+static std::vector<LayoutItem> makeItems(int count)
+{
+	std::vector<LayoutItem> items;
+	for (int i = 0; i < count; i++) {
+		items.push_back({
+			.visible = i % 17 != 0,
+			.width = 20 + i * 7 % 60,
+			.padLeft = 5,
+			.padRight = 5,
+			.maxWidth = i % 5 == 0 ? 40 : 0,
+			.priority = i % 4,
+			.group = (LayoutGroup)(i % 3),
+			.overflow = i % 2 ? LayoutOverflow::Ellipsize : LayoutOverflow::Hide,
+			.separator = i % 6 == 0,
+		});
+	}
+	return items;
+}
+
+int main(int argc, char **argv)
+{
+	int count = argc > 1 ? std::max(atoi(argv[1]), 1) : 300;
+	int rounds = argc > 2 ? std::max(atoi(argv[2]), 1) : 20000;
+	std::vector<LayoutItem> items = makeItems(count);
+	long shown = 0; // Read back so nothing is optimized away
+
+	Layout layout;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) {
+		computeLayout(items, LAYOUTBENCH_BAR_WIDTH, LAYOUTBENCH_SEPARATOR_WIDTH, layout);
+		shown += layout.spans[i % count].shown;
+	}
+	double computeNs = nsPer(start, rounds);
+
+	LayoutEngine engine(LAYOUTBENCH_SEPARATOR_WIDTH);
+	engine.update(items, LAYOUTBENCH_BAR_WIDTH);
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) {
+		shown += engine.update(items, LAYOUTBENCH_BAR_WIDTH);
+	}
+	double unchangedNs = nsPer(start, rounds);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) {
+		items[i * 31 % count].width ^= 8; // One block's text changed width
+		shown += engine.update(items, LAYOUTBENCH_BAR_WIDTH);
+	}
+	double changedNs = nsPer(start, rounds);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) {
+		shown += engine.update(items, LAYOUTBENCH_BAR_WIDTH - (i & 1) * 100);
+	}
+	double resizedNs = nsPer(start, rounds);
+
+	printf("%d items, %d rounds: computeLayout %.2f us, update unchanged %.2f us, one width changed %.2f us, "
+			"bar resized %.2f us (%ld)\n", count, rounds, computeNs / 1000, unchangedNs / 1000, changedNs / 1000,
+			resizedNs / 1000, shown);
+	return 0;
+}
@@ -0,0 +1,165 @@
+// Pushes block updates to a running wblocks2, and benchmarks the endpoint
+//
+//   wbpush text NAME TEXT
+//   wbpush color NAME R G B
+//   wbpush show NAME 0|1
+//   wbpush remove NAME - Drops a block pushes made, scripts' blocks stay
+//   wbpush bench [UPDATES [BLOCKS [PER_WRITE]]] - Floods text updates and reports the rate
+//   wbpush sink - Serves the endpoint itself and reports what it receives, to bench without a bar
+//
+// `-e ENDPOINT` before the command overrides the default pipe or socket.
+
+#include "ipc.h"
+#include "stats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+static int usage()
+{
+	fprintf(stderr, "usage: wbpush [-e ENDPOINT] text NAME TEXT | color NAME R G B | show NAME 0|1 | remove NAME |\n"
+			"              bench [UPDATES [BLOCKS [PER_WRITE]]] | sink\n");
+	return 2;
+}
+
+static int push(const std::string& endpoint, const std::string& frames)
+{
+	IpcClient client;
+	std::string err;
+	if (!client.connect(endpoint, err)) {
+		fprintf(stderr, "wbpush: %s\n", err.c_str());
+		return 1;
+	}
+	if (!client.send(frames)) {
+		fprintf(stderr, "wbpush: write failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int bench(const std::string& endpoint, long updates, int blocks, int perWrite)
+{
+	IpcClient client;
+	std::string err;
+	if (!client.connect(endpoint, err)) {
+		fprintf(stderr, "wbpush: %s\n", err.c_str());
+		return 1;
+	}
+
+	// Looks like a daemon reporting counters, one block after the other
+	std::string frames;
+	char name[32], text[64];
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < updates; i++) {
+		snprintf(name, sizeof(name), "bench%d", (int)(i % blocks));
+		int len = snprintf(text, sizeof(text), "%ld updates", i);
+		ipcEncode(frames, IpcOp::Text, name, std::string_view(text, len));
+		if ((i + 1) % perWrite == 0 || i + 1 == updates) {
+			if (!client.send(frames)) {
+				fprintf(stderr, "wbpush: write failed after %ld updates\n", i);
+				return 1;
+			}
+			frames.clear();
+		}
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%ld updates to %d blocks, %d per write: %.3f s, %.0f updates/s\n", updates, blocks, perWrite, secs,
+			updates / secs);
+	return 0;
+}
+
+static int sink(const std::string& endpoint)
+{
+	// Stands in for the bar: one lock per batch, last write wins per block
+	std::mutex mutex;
+	std::unordered_map<std::string, std::string> texts;
+	std::string err;
+	bool ok = ipcListen(endpoint, [&](std::vector<IpcMessage>& batch) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (IpcMessage& msg : batch) {
+			if (msg.op == IpcOp::Text) {
+				texts[msg.name] = std::move(msg.value);
+			}
+		}
+	}, err);
+	if (!ok) {
+		fprintf(stderr, "wbpush: %s\n", err.c_str());
+		return 1;
+	}
+	printf("Listening on %s\n", endpoint.c_str());
+
+	uint64_t lastMessages = 0, lastBatches = 0;
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		uint64_t messages = stats.ipcMessages.value.load(), batches = stats.ipcBatches.value.load();
+		if (messages != lastMessages) {
+			printf("%llu updates/s in %llu batches, %llu rejected\n", (unsigned long long)(messages - lastMessages),
+					(unsigned long long)(batches - lastBatches), (unsigned long long)stats.ipcRejected.value.load());
+			fflush(stdout);
+		}
+		lastMessages = messages;
+		lastBatches = batches;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string endpoint = ipcDefaultEndpoint();
+	int arg = 1;
+	if (argc > 2 && !strcmp(argv[1], "-e")) {
+		endpoint = argv[2];
+		arg = 3;
+	}
+	if (arg >= argc) {
+		return usage();
+	}
+	const char *cmd = argv[arg++];
+	int left = argc - arg;
+
+	std::string frames;
+	if (!strcmp(cmd, "text") && left == 2) {
+		if (!ipcEncode(frames, IpcOp::Text, argv[arg], argv[arg + 1])) {
+			return usage();
+		}
+		return push(endpoint, frames);
+	}
+	if (!strcmp(cmd, "color") && left == 4) {
+		char rgb[3] = { (char)atoi(argv[arg + 1]), (char)atoi(argv[arg + 2]), (char)atoi(argv[arg + 3]) };
+		if (!ipcEncode(frames, IpcOp::Color, argv[arg], std::string_view(rgb, 3))) {
+			return usage();
+		}
+		return push(endpoint, frames);
+	}
+	if (!strcmp(cmd, "show") && left == 2) {
+		char visible = atoi(argv[arg + 1]) != 0;
+		if (!ipcEncode(frames, IpcOp::Visible, argv[arg], std::string_view(&visible, 1))) {
+			return usage();
+		}
+		return push(endpoint, frames);
+	}
+	if (!strcmp(cmd, "remove") && left == 1) {
+		if (!ipcEncode(frames, IpcOp::Remove, argv[arg], "")) {
+			return usage();
+		}
+		return push(endpoint, frames);
+	}
+	if (!strcmp(cmd, "bench") && left <= 3) {
+		long updates = left > 0 ? atol(argv[arg]) : 1000000;
+		int blocks = left > 1 ? atoi(argv[arg + 1]) : 10;
+		int perWrite = left > 2 ? atoi(argv[arg + 2]) : 1;
+		if (updates <= 0 || blocks <= 0 || perWrite <= 0) {
+			return usage();
+		}
+		return bench(endpoint, updates, blocks, perWrite);
+	}
+	if (!strcmp(cmd, "sink") && left == 0) {
+		return sink(endpoint);
+	}
+	return usage();
+}
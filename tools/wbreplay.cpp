@@ -0,0 +1,497 @@
+// Replays a trace recorded with "Record Trace" against the portable block model and renderer
+//
+//   wbreplay [-s SPEED] [-n LOOPS] [-b BARS] TRACE
+//
+// SPEED is 0 to go as fast as possible (the default) or a factor of the original pace, 1 being
+// real time. Text is drawn as boxes of the widths measured while recording, the bar planning, layout,
+// graphs, images and separators go through the same code as the bar. BARS replaces the recorded
+// taskbars with simulated ones, like `1920x40@96,1920x40@96,1280x30@144`, the primary first. Animated blocks
+// are advanced a frame at a time through the recorded time between events, redrawing only their spans.
+
+#include "animation.h"
+#include "barplan.h"
+#include "graph.h"
+#include "imagecache.h"
+#include "layout.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define REPLAY_SEPARATOR_WIDTH 9 // As WBLOCKS_SEPARATOR_WIDTH
+#define REPLAY_VISUAL_GAP 4 // As WBLOCKS_VISUAL_GAP
+#define REPLAY_FRAME_US (1000000 / 30) // As WBLOCKS_ANIMATION_FPS
+
+struct ReplayBlock {
+	LayoutItem item;
+	std::string text;
+	int textWidth = 0;
+	uint32_t color = 0xffffff;
+	bool interactive = false;
+	std::shared_ptr<Image> image;
+	std::shared_ptr<Graph> graph;
+	int graphHeight = 0;
+	BarMask bars = barMaskAll;
+	Animation animation;
+	uint64_t animationStartUs = 0;
+	AnimationFrame frame;
+
+	// Same as Block::visualWidth
+	int visualWidth() const {
+		int width = 0;
+		if (image) {
+			width += image->width + REPLAY_VISUAL_GAP;
+		}
+		if (graph) {
+			width += graph->columns() + REPLAY_VISUAL_GAP;
+		}
+		return width && text.empty() ? width - REPLAY_VISUAL_GAP : width;
+	}
+
+	// Same as Block::animate
+	bool animate(uint64_t frameUs) {
+		if (animation.kind == AnimationKind::None) {
+			return false;
+		}
+		AnimationFrame next = animationFrame(animation, frameUs - std::min(frameUs, animationStartUs), textWidth);
+		if (next == frame) {
+			return false;
+		}
+		frame = next;
+		return true;
+	}
+
+	bool animatesIn(const LayoutSpan& span) const {
+		return animation.kind == AnimationKind::Marquee ? span.ellipsized : animation.kind != AnimationKind::None;
+	}
+};
+
+struct ReplayTotals {
+	uint64_t events = 0, mutations = 0, frames = 0, layouts = 0, surfaces = 0, presents = 0;
+	uint64_t layoutUs = 0, renderUs = 0, maxFrameUs = 0;
+	uint64_t recordedRedraws = 0, recordedPresents = 0, recordedRedrawUs = 0, recordedPresentUs = 0;
+	uint64_t shells = 0, shellRunUs = 0, shellResolveUs = 0;
+	uint64_t animationFrames = 0, animatedRegions = 0, animationUs = 0;
+	uint64_t recordedAnimationFrames = 0, recordedAnimatedRegions = 0, recordedAnimationUs = 0;
+};
+
+class Replay {
+	std::unordered_map<uint64_t, ReplayBlock> blocks; // 0 is the default block
+	std::vector<uint64_t> order;
+	std::vector<uint64_t> drawnOrder; // As of the last frame, what the surface items index
+	std::map<std::pair<int, int>, std::shared_ptr<Image>> images; // Stand-ins by size
+	std::unordered_map<uint64_t, uint64_t> shellStarts;
+	std::vector<BarGeometry> simulated;
+	BarPlanner planner{REPLAY_SEPARATOR_WIDTH};
+	std::vector<std::vector<uint32_t>> rasters; // Indexed like the planner surfaces
+	bool animated = false; // Some block was given an animation
+	uint64_t nextFrameUs = 0;
+
+	std::shared_ptr<Image> imageOfSize(int width, int height) {
+		auto& image = images[{width, height}];
+		if (!image) {
+			image = std::make_shared<Image>(Image{ .width = width, .height = height,
+					.pixels = std::vector<uint32_t>(width * height, 0xff808080) });
+		}
+		return image;
+	}
+
+	void fill(std::vector<uint32_t>& pixels, int x0, int y0, int x1, int y1, int width, int height, uint32_t pixel) {
+		x0 = std::max(x0, 0);
+		y0 = std::max(y0, 0);
+		x1 = std::min(x1, width);
+		y1 = std::min(y1, height);
+		for (int y = y0; y < y1; y++) {
+			std::fill(pixels.begin() + y * width + x0, pixels.begin() + y * width + std::max(x0, x1), pixel);
+		}
+	}
+
+	// Mirrors drawBlock and compositeBlock, text drawn as a box, scrolled like a marquee if animated as one
+	void drawSpan(std::vector<uint32_t>& pixels, int width, int height, ReplayBlock& block, const LayoutSpan& span) {
+		uint32_t pixel = 0xff000000 | ((block.color & 0xff) << 16) | (block.color & 0xff00) | ((block.color >> 16) & 0xff);
+		int x = span.contentX, right = std::min(span.contentX + span.contentWidth, width);
+		if (block.animation.kind != AnimationKind::Marquee || !span.ellipsized) {
+			fill(pixels, x + block.visualWidth(), height / 3, right, height - height / 3, width, height, pixel);
+		} else {
+			int textX = x + block.visualWidth(), left = textX - block.frame.offset;
+			for (int pass = 0; pass < 2 && left < right; pass++, left += block.textWidth + block.animation.gap) {
+				fill(pixels, std::max(left, textX), height / 3, std::min(left + block.textWidth, right),
+						height - height / 3, width, height, pixel);
+			}
+		}
+		if (block.image) {
+			compositeImage(pixels.data(), width, height, *block.image, x, (height - block.image->height) / 2, right);
+			x += block.image->width + REPLAY_VISUAL_GAP;
+		}
+		if (block.graph) {
+			int graphHeight = std::min(block.graphHeight ? block.graphHeight : height * 3 / 5, height);
+			block.graph->render(graphHeight, block.color);
+			int top = (height - graphHeight) / 2;
+			int columns = std::min((int)block.graph->columns(), right - x);
+			for (int y = 0; y < graphHeight && columns > 0; y++) {
+				memcpy(pixels.data() + (top + y) * width + x, block.graph->pixels() + y * block.graph->columns(),
+						columns * sizeof(uint32_t));
+			}
+		}
+		int x0 = std::max(span.x, 0), x1 = std::min(span.x + span.width, width);
+		fadePixels(pixels.data(), width, x0, x1, height, block.frame.alpha);
+		if (block.interactive) {
+			for (int y = 0; y < height; y++) {
+				for (int px = x0; px < x1; px++) {
+					pixels[y * width + px] |= 0x01000000;
+				}
+			}
+		}
+	}
+
+	// Mirrors drawSurface with GDI text swapped for boxes
+	void renderSurface(const BarSurface& surface, std::vector<uint32_t>& pixels) {
+		int width = surface.geometry.width, height = surface.geometry.height;
+		const Layout& bar = surface.layout.get();
+		pixels.assign((size_t)width * height, 0);
+		for (size_t i = 0; i < surface.items.size(); i++) {
+			if (bar.spans[i].shown) {
+				drawSpan(pixels, width, height, blocks[drawnOrder[surface.items[i]]], bar.spans[i]);
+			}
+		}
+		for (const LayoutSeparator& sep : bar.separators) {
+			uint32_t color = blocks[drawnOrder[surface.items[sep.item]]].color;
+			fill(pixels, sep.x, height / 5, sep.x + 1, height - height / 5, width, height, 0xff000000 | color);
+		}
+	}
+
+	// Mirrors drawAnimations, for the blocks as of the last frame
+	void animationTick(uint64_t frameUs) {
+		uint64_t start = nowUs();
+		std::vector<bool> moved(drawnOrder.size());
+		bool anyMoved = false;
+		for (size_t i = 0; i < drawnOrder.size(); i++) {
+			moved[i] = blocks[drawnOrder[i]].animate(frameUs);
+			anyMoved = anyMoved || moved[i];
+		}
+		if (!anyMoved) {
+			return;
+		}
+		size_t regions = 0;
+		for (size_t s = 0; s < planner.get().size() && s < rasters.size(); s++) {
+			const BarSurface& surface = planner.get()[s];
+			const Layout& bar = surface.layout.get();
+			int width = surface.geometry.width, height = surface.geometry.height;
+			for (size_t i = 0; i < surface.items.size(); i++) {
+				const LayoutSpan& span = bar.spans[i];
+				ReplayBlock& block = blocks[drawnOrder[surface.items[i]]];
+				if (!moved[surface.items[i]] || !span.shown || !block.animatesIn(span)) {
+					continue;
+				}
+				fill(rasters[s], span.x, 0, span.x + span.width, height, width, height, 0);
+				drawSpan(rasters[s], width, height, block, span);
+				regions++;
+			}
+		}
+		if (regions) {
+			totals.animationFrames++;
+			totals.animatedRegions += regions;
+			totals.animationUs += nowUs() - start;
+		}
+	}
+
+	// Every frame the clock would have ticked up to `timeUs` of the trace
+	void advance(uint64_t timeUs) {
+		if (!animated || !totals.frames) {
+			nextFrameUs = timeUs;
+			return;
+		}
+		for (; nextFrameUs <= timeUs; nextFrameUs += REPLAY_FRAME_US) {
+			animationTick(nextFrameUs);
+		}
+	}
+
+	// Mirrors updateBlocks, every surface drawn once and counted as presented to each of its bars
+	void frame(const std::vector<BarGeometry>& bars, uint64_t timeUs) {
+		uint64_t start = nowUs();
+		std::vector<LayoutItem> items;
+		std::vector<BarMask> masks;
+		items.reserve(order.size());
+		masks.reserve(order.size());
+		for (uint64_t id : order) {
+			ReplayBlock& block = blocks[id];
+			block.item.width = block.visualWidth() + block.textWidth;
+			items.push_back(block.item);
+			masks.push_back(block.bars);
+		}
+		planner.plan(bars, masks);
+		std::vector<bool> changed;
+		planner.layout(items, changed);
+		totals.layouts += std::count(changed.begin(), changed.end(), true);
+		uint64_t laidOut = nowUs();
+		totals.layoutUs += laidOut - start;
+		drawnOrder = order;
+		for (uint64_t id : order) {
+			blocks[id].animate(timeUs);
+		}
+
+		rasters.resize(planner.get().size());
+		for (size_t s = 0; s < planner.get().size(); s++) {
+			const BarSurface& surface = planner.get()[s];
+			renderSurface(surface, rasters[s]);
+			totals.surfaces++;
+			totals.presents += surface.bars.size();
+		}
+
+		uint64_t took = nowUs() - start;
+		totals.renderUs += nowUs() - laidOut;
+		totals.maxFrameUs = std::max(totals.maxFrameUs, took);
+		totals.frames++;
+	}
+
+public:
+	ReplayTotals totals;
+
+	Replay(std::vector<BarGeometry> simulated) : simulated(std::move(simulated)) {};
+
+	void apply(const TraceEvent& ev) {
+		advance(ev.timeUs);
+		totals.events++;
+		if ((ev.op >= TraceOp::Create && ev.op <= TraceOp::Samples) || ev.op == TraceOp::Bars
+				|| ev.op == TraceOp::Animation) {
+			totals.mutations++;
+		}
+		ReplayBlock& block = blocks[ev.id];
+		switch (ev.op) {
+		case TraceOp::Create:
+			block = blocks[ev.arg(0)];
+			block.interactive = false;
+			block.graph = nullptr;
+			order.push_back(ev.id);
+			break;
+		case TraceOp::Remove:
+			order.erase(std::remove(order.begin(), order.end(), ev.id), order.end());
+			break;
+		case TraceOp::Text:
+		case TraceOp::Segments:
+			if (block.animation.kind == AnimationKind::Marquee && block.text != ev.str) {
+				block.animationStartUs = ev.timeUs;
+			}
+			block.text = ev.str;
+			break;
+		case TraceOp::Font:
+			break; // Shows up as the next Measure
+		case TraceOp::Color:
+			block.color = ev.arg(0);
+			break;
+		case TraceOp::Padding:
+			block.item.padLeft = ev.arg(0);
+			block.item.padRight = ev.arg(1);
+			break;
+		case TraceOp::Visible:
+			block.item.visible = ev.arg(0);
+			break;
+		case TraceOp::Group:
+			block.item.group = (LayoutGroup)ev.arg(0);
+			break;
+		case TraceOp::Width:
+			block.item.minWidth = ev.arg(0);
+			block.item.maxWidth = ev.arg(1);
+			break;
+		case TraceOp::Priority:
+			block.item.priority = ev.arg(0);
+			break;
+		case TraceOp::Overflow:
+			block.item.overflow = (LayoutOverflow)ev.arg(0);
+			break;
+		case TraceOp::Separator:
+			block.item.separator = ev.arg(0);
+			break;
+		case TraceOp::Interactive:
+			block.interactive = ev.arg(0);
+			break;
+		case TraceOp::Image:
+			block.image = ev.arg(0) > 0 && ev.arg(1) > 0 ? imageOfSize(ev.arg(0), ev.arg(1)) : nullptr;
+			break;
+		case TraceOp::Graph:
+			block.graph = ev.arg(0) > 0 ? std::make_shared<Graph>(ev.arg(0),
+					std::bit_cast<float>((uint32_t)ev.arg(2)), std::bit_cast<float>((uint32_t)ev.arg(3))) : nullptr;
+			block.graphHeight = ev.arg(1);
+			break;
+		case TraceOp::Samples:
+			if (block.graph) {
+				for (int64_t bits : ev.ints) {
+					block.graph->push(std::bit_cast<float>((uint32_t)bits));
+				}
+			}
+			break;
+		case TraceOp::Measure:
+			block.textWidth = std::max((int)ev.arg(0), 0);
+			break;
+		case TraceOp::Redraw:
+			// A frame draws the surface of the primary first, the others only add to the recorded times
+			if (ev.id == 0 && ev.arg(0) > 0 && ev.arg(1) > 0) {
+				frame(!simulated.empty() ? simulated
+						: std::vector<BarGeometry>{{ (int)ev.arg(0), (int)ev.arg(1), (int)ev.arg(3) }}, ev.timeUs);
+			}
+			totals.recordedRedraws++;
+			totals.recordedRedrawUs += ev.arg(2);
+			break;
+		case TraceOp::Present:
+			totals.recordedPresents++;
+			totals.recordedPresentUs += ev.arg(0);
+			break;
+		case TraceOp::ShellStart:
+			shellStarts[ev.id] = ev.timeUs;
+			totals.shells++;
+			break;
+		case TraceOp::ShellExit: {
+			auto it = shellStarts.find(ev.id);
+			if (it != shellStarts.end()) {
+				totals.shellRunUs += ev.timeUs - it->second;
+				shellStarts.erase(it);
+			}
+			break;
+		}
+		case TraceOp::ShellResolve:
+			totals.shellResolveUs += ev.arg(0);
+			break;
+		case TraceOp::Bars:
+			block.bars = ev.arg(0);
+			break;
+		case TraceOp::Animation:
+			block.animation = {
+				.kind = (AnimationKind)ev.arg(0),
+				.speed = (int)ev.arg(1),
+				.gap = (int)ev.arg(2),
+				.periodMs = (int)ev.arg(3),
+				.minAlpha = (uint8_t)ev.arg(4),
+			};
+			block.animationStartUs = ev.timeUs;
+			block.frame = {};
+			animated = animated || block.animation.kind != AnimationKind::None;
+			break;
+		case TraceOp::Animate:
+			totals.recordedAnimationFrames++;
+			totals.recordedAnimatedRegions += ev.arg(0);
+			totals.recordedAnimationUs += ev.arg(1);
+			break;
+		}
+	}
+};
+
+static double avg(uint64_t total, uint64_t count)
+{
+	return count ? (double)total / count : 0;
+}
+
+// `WxH@DPI` separated by commas
+static bool parseBars(const char *str, std::vector<BarGeometry>& bars)
+{
+	while (*str) {
+		BarGeometry bar;
+		int n;
+		if (sscanf(str, "%dx%d@%d%n", &bar.width, &bar.height, &bar.dpi, &n) != 3 || bar.width <= 0 || bar.height <= 0
+				|| bars.size() == BAR_MAX) {
+			return false;
+		}
+		bars.push_back(bar);
+		str += n;
+		if (*str == ',') {
+			str++;
+		} else if (*str) {
+			return false;
+		}
+	}
+	return !bars.empty();
+}
+
+int main(int argc, char **argv)
+{
+	double speed = 0;
+	int loops = 1;
+	std::vector<BarGeometry> bars;
+	bool badBars = false;
+	int arg = 1;
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		if (!strcmp(argv[arg], "-s")) {
+			speed = atof(argv[arg + 1]);
+		} else if (!strcmp(argv[arg], "-n")) {
+			loops = std::max(atoi(argv[arg + 1]), 1);
+		} else if (!strcmp(argv[arg], "-b")) {
+			badBars = !parseBars(argv[arg + 1], bars);
+		} else {
+			break;
+		}
+	}
+	if (arg + 1 != argc || speed < 0 || badBars) {
+		fprintf(stderr, "usage: wbreplay [-s SPEED] [-n LOOPS] [-b WxH@DPI,...] TRACE\n");
+		return 2;
+	}
+
+	FILE *f = fopen(argv[arg], "rb");
+	if (!f) {
+		fprintf(stderr, "wbreplay: can't open %s\n", argv[arg]);
+		return 1;
+	}
+	std::vector<uint8_t> data;
+	uint8_t chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		data.insert(data.end(), chunk, chunk + n);
+	}
+	fclose(f);
+
+	// Decoded up front so reading doesn't count towards the replay
+	TraceReader reader;
+	if (!reader.open(data.data(), data.size())) {
+		fprintf(stderr, "wbreplay: %s is not a trace\n", argv[arg]);
+		return 1;
+	}
+	std::vector<TraceEvent> events;
+	TraceEvent ev;
+	while (reader.next(ev)) {
+		events.push_back(ev);
+	}
+	if (!reader.done()) {
+		fprintf(stderr, "wbreplay: trace cut off after %zu events, replaying those\n", events.size());
+	}
+	uint64_t durationUs = events.empty() ? 0 : events.back().timeUs;
+
+	for (int loop = 0; loop < loops; loop++) {
+		Replay replay(bars);
+		auto start = std::chrono::steady_clock::now();
+		for (const TraceEvent& event : events) {
+			if (speed > 0) {
+				std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t)(event.timeUs / speed)));
+			}
+			replay.apply(event);
+		}
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const ReplayTotals& t = replay.totals;
+		printf("Replay %d: %llu events (%llu mutations) recorded over %.3f s, replayed in %.3f s\n", loop + 1,
+				(unsigned long long)t.events, (unsigned long long)t.mutations, durationUs / 1e6, secs);
+		printf("  Frames: %llu, %llu surfaces drawn for %llu presents, %llu relayouts\n", (unsigned long long)t.frames,
+				(unsigned long long)t.surfaces, (unsigned long long)t.presents, (unsigned long long)t.layouts);
+		printf("  Per frame: layout avg %.1f us, render avg %.1f us, max %llu us\n", avg(t.layoutUs, t.frames),
+				avg(t.renderUs, t.frames), (unsigned long long)t.maxFrameUs);
+		printf("  Recorded: redraw avg %.1f us, present avg %.1f us\n", avg(t.recordedRedrawUs, t.recordedRedraws),
+				avg(t.recordedPresentUs, t.recordedPresents));
+		printf("  Commands: %llu, run avg %.1f ms, resolve avg %.1f us\n", (unsigned long long)t.shells,
+				avg(t.shellRunUs, t.shells) / 1000, avg(t.shellResolveUs, t.shells));
+		if (t.animationFrames || t.recordedAnimationFrames) {
+			printf("  Animation: %llu frames, %llu regions, %.2f us per region (recorded %.2f us over %llu frames)\n",
+					(unsigned long long)t.animationFrames, (unsigned long long)t.animatedRegions,
+					avg(t.animationUs, t.animatedRegions), avg(t.recordedAnimationUs, t.recordedAnimatedRegions),
+					(unsigned long long)t.recordedAnimationFrames);
+		}
+	}
+	return 0;
+}